@@ -3,16 +3,82 @@
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <vector>
 
+#include "compute_batch.h"
+#include "deletion_queue.h"
+#include "frame_metrics.h"
+#include "gpu_trace.h"
+#include "hiz_pyramid.h"
+#include "memory_budget.h"
+#include "mesh.h"
+#include "pass_queries.h"
+#include "render_graph.h"
+#include "render_queue.h"
+#include "resolution_scaler.h"
+#include "scene.h"
+#include "specialization.h"
+#include "staging_ring.h"
+#include "vk_handle.h"
+
 class Application {
 public:
+  // meshPath optionally names a .mvm file uploaded at start up
+  explicit Application(std::string meshPath = "");
+
   void run();
 
+  // Headless: runs `jobCount` jobs of shaders/batch_filter.comp, each
+  // filtering `jobBytes` of floats, and reports the sustained throughput.
+  // No window is opened, the device only gets compute and transfer queues.
+  // Throws if a job fails or its output differs from the CPU's.
+  void runBatch(uint32_t jobCount, VkDeviceSize jobBytes);
+
 private:
   const uint32_t WIDTH = 800;
   const uint32_t HEIGHT = 600;
 
+  static const int MAX_FRAMES_IN_FLIGHT = 2;
+
+  // upper bound for MYVK_WINDOWS
+  static const uint32_t MAX_WINDOWS = 8;
+
+  static const VkDeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;
+
+  // benchmark times of the devices seen so far, unless MYVK_DEVICE_CACHE
+  // names another file
+  static constexpr const char *DEVICE_CACHE_PATH = "device_cache.txt";
+
+  // frames between trace flushes, so the per-thread rings do not overflow;
+  // F12 flushes right away
+  static const uint64_t TRACE_FLUSH_INTERVAL = 256;
+  // timestamp ranges per command buffer: the frame and each graph pass
+  static const uint32_t GPU_TRACE_RANGES = 8;
+
+  // dynamic resolution: the GPU frame time aimed for, shared by all windows,
+  // and the smallest fraction of the swap chain resolution the scene is
+  // rendered at
+  static constexpr double TARGET_GPU_MILLISECONDS = 12.0;
+  static constexpr float MIN_RENDER_SCALE = 0.5f;
+
+  // local size of shaders/meshlet_cull.comp, specialized at pipeline creation
+  static const uint32_t MESHLET_CULL_GROUP_SIZE = 64;
+  // ambient term of the mesh shading, specialized into shaders/mesh.vert
+  static constexpr float AMBIENT_LIGHT = 0.1f;
+  // coarsest LOD whose error projects to at most this many pixels is used
+  static constexpr float LOD_PIXEL_ERROR = 1.0f;
+
+  // the demo scene: a grid of clusters, each a root entity with children
+  // orbiting it, every entity an instance of the loaded mesh
+  static const uint32_t SCENE_GRID = 16;
+  static const uint32_t SCENE_CLUSTER_CHILDREN = 8;
+
   static const int DEVICE_EXTENSIONS_COUNT = 2;
   static const char *DEVICE_EXTENSIONS[];
 
@@ -20,36 +86,226 @@ private:
   VkDebugReportCallbackEXT callback{};
 #endif
 
-  GLFWwindow *window{};
+  // A window with its surface, swap chain and everything sized by them. The
+  // swap chain images of all windows are numbered consecutively as slots;
+  // command buffers, meshlet frames, queries and timestamps are per slot.
+  struct Window {
+    GLFWwindow *handle = nullptr;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+
+    UniqueSwapchain swapChain;
+    std::vector<VkImage> images;
+    VkExtent2D extent = {};
+    std::vector<UniqueImageView> imageViews;
+    VkImageUsageFlags usage = 0;
+    std::vector<UniqueFramebuffer> framebuffers;
+    // slot of images[0]
+    uint32_t firstSlot = 0;
+
+    RenderGraph renderGraph;
+    RenderGraph::ResourceId backBuffer = 0;
+
+    // With dynamic resolution the main pass renders the top left
+    // renderExtent of sceneColor, a swap chain sized target, which is then
+    // blitted onto the back buffer. Without blit support it renders to the
+    // back buffer directly.
+    bool dynamicResolution = false;
+    RenderGraph::ResourceId sceneColor = 0;
+    UniqueFramebuffer sceneFramebuffer;
+    ResolutionScaler resolutionScaler{TARGET_GPU_MILLISECONDS,
+                                      MIN_RENDER_SCALE, 1.0f};
+    VkExtent2D renderExtent = {};
+
+    // lazily allocated attachments of the main pass, never stored: depth and,
+    // with MSAA, the multisampled color resolved into the pass target
+    RenderGraph::ResourceId depth = 0;
+    RenderGraph::ResourceId msaaColor = 0;
+
+    // Two-phase occlusion culling: a depth prepass draws what survived
+    // culling against last frame's pyramid, `hiz` is rebuilt from that depth
+    // and the rejects are tested again against it
+    HiZPyramid hiz;
+    RenderGraph::ResourceId hizDepth = 0;
+    RenderGraph::ResourceId hizPyramid = 0;
+    UniqueFramebuffer hizFramebuffer;
+    // what `hiz` was built with, for the next frame's early pass
+    glm::mat4 previousViewProj = glm::mat4(0.0f);
+    VkExtent2D previousRenderExtent = {};
+
+    UniqueSemaphore imageAvailableSemaphores[MAX_FRAMES_IN_FLIGHT];
+    // image acquired for the current frame, false if acquiring failed
+    uint32_t imageIndex = 0;
+    bool acquired = false;
+  };
+
+  // created once and never resized, the render graph passes point into it
+  std::vector<Window> windows;
+  // no windows nor swap chain extensions, for runBatch
+  bool headless = false;
+  // swap chain images of all windows
+  uint32_t slotCount = 0;
 
   VkInstance instance{};
 
   VkPhysicalDevice physicalDevice{};
   VkDevice device{};
 
-  VkSwapchainKHR swapChain;
-  std::vector<VkImage> swapChainImages;
+  // shared by all windows, so they can share the render pass and pipelines
   VkFormat swapChainImageFormat;
-  VkExtent2D swapChainExtent;
-  std::vector<VkImageView> swapChainImageViews;
+  VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+  // 4x where the device supports it for both color and depth
+  VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
   VkQueue graphicsQueue{};
   VkQueue presentQueue{};
 
-  VkRenderPass renderPass;
-  VkPipelineLayout pipelineLayout;
-
-  VkPipeline graphicsPipeline;
+  UniqueRenderPass renderPass;
+  UniquePipelineLayout pipelineLayout;
+
+  UniquePipeline graphicsPipeline;
+
+  // render extent each command buffer was recorded with
+  std::vector<VkExtent2D> recordedExtents;
+  uint32_t renderScaleMetric = 0;
+
+  // Rebuilt for every command buffer recorded, with the draws of its slot.
+  // Pass ids of the sort keys, and pipeline ids, in recording order.
+  static const uint32_t QUEUE_PASS_DEPTH = 0;
+  static const uint32_t QUEUE_PASS_MAIN = 1;
+  static const uint32_t QUEUE_PIPELINE_DEPTH = 0;
+  static const uint32_t QUEUE_PIPELINE_MAIN = 1;
+  RenderQueue renderQueue;
+  // what recording each slot's command buffer flushed, reported whenever
+  // the slot is submitted
+  std::vector<RenderQueue::Stats> renderQueueStats;
+  // draws, then pipeline, descriptor set, vertex and index buffer binds
+  uint32_t renderQueueMetrics[5] = {};
+
+  struct GpuMesh {
+    UniqueBuffer vertexBuffer;
+    UniqueDeviceMemory vertexMemory;
+    UniqueBuffer indexBuffer;
+    UniqueDeviceMemory indexMemory;
+    UniqueBuffer meshletBuffer;
+    UniqueDeviceMemory meshletMemory;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    float boundsMin[3]{};
+    float boundsMax[3]{};
+    std::vector<MeshLod> lods;
+    // one indirect draw per meshlet of any LOD
+    uint32_t drawSlots = 0;
+  };
 
-  std::vector<VkFramebuffer> swapChainFramebuffers;
+  // per slot, the culling pass and the draws of a command buffer use the
+  // buffers of its slot
+  struct MeshletFrameResources {
+    UniqueBuffer uniformBuffer;
+    UniqueDeviceMemory uniformMemory;
+    void *uniformData = nullptr;
+    UniqueBuffer drawBuffer;
+    UniqueDeviceMemory drawMemory;
+    // visible scene instances, grouped by LOD
+    UniqueBuffer instanceBuffer;
+    UniqueDeviceMemory instanceMemory;
+    SceneInstance *instanceData = nullptr;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  };
 
-  VkCommandPool commandPool;
+  std::string meshPath;
+  GpuMesh mesh;
+  StagingRing stagingRing;
+
+  UniqueDescriptorSetLayout meshletSetLayout;
+  UniqueDescriptorPool descriptorPool;
+  UniquePipeline cullPipeline;
+  // Hi-Z occlusion culling needs a mesh, rg32f storage images and a sampled
+  // D32 depth format; MYVK_NO_OCCLUSION turns it off. The draw buffers then
+  // hold the early draws followed by the late ones.
+  bool occlusionCulling = false;
+  UniquePipeline lateCullPipeline;
+  // depth only, into a single sampled HiZPyramid::DEPTH_FORMAT buffer
+  UniqueRenderPass depthRenderPass;
+  UniquePipeline depthPrepassPipeline;
+  std::vector<MeshletFrameResources> meshletFrames;
+  // 1 without the multiDrawIndirect feature
+  uint32_t maxDrawIndirectCount = 1;
+  // without it every instance uses LOD 0, so draws start at instance 0
+  bool drawIndirectFirstInstance = false;
+  bool pipelineStatisticsQuery = false;
+  bool occlusionQueryPrecise = false;
+  bool calibratedTimestamps = false;
+  // Vulkan 1.3 dynamic rendering and synchronization2: no render pass or
+  // framebuffers, pipelines only know the attachment formats. MYVK_RENDER_PASS
+  // keeps the render pass path.
+  bool dynamicRendering = false;
+  uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+  PFN_vkCmdBeginRendering cmdBeginRendering = nullptr;
+  PFN_vkCmdEndRendering cmdEndRendering = nullptr;
+  PFN_vkCmdPipelineBarrier2 cmdPipelineBarrier2 = nullptr;
+  uint32_t graphicsQueueFamily = 0;
+  // where ComputeBatch runs; apart from the graphics family where the device
+  // has such families, the graphics family otherwise
+  uint32_t computeQueueFamily = 0;
+  uint32_t transferQueueFamily = 0;
+
+  // Scene state is double buffered: the simulation thread updates one
+  // snapshot for frame N + 1 while the render thread draws frame N from the
+  // other. createScene builds both alike, and the simulation derives all
+  // that moves from the snapshot time, so neither needs the other's state.
+  struct SceneSnapshot {
+    Scene scene;
+    // glfwGetTime() the snapshot was simulated for
+    float time = 0.0f;
+  };
+  SceneSnapshot snapshots[2];
+  std::vector<Scene::EntityId> sceneRoots;
+  std::mutex snapshotMutex;
+  std::condition_variable snapshotChanged;
+  // the snapshot waiting for the render thread and the one it draws, -1 for
+  // none; the simulation writes neither
+  int publishedSnapshot = -1;
+  int renderedSnapshot = -1;
+  std::atomic<bool> running{false};
+
+  UniqueCommandPool commandPool;
+  // per slot
   std::vector<VkCommandBuffer> commandBuffers;
 
-  VkSemaphore imageAvailableSemaphore;
-  VkSemaphore renderFinishedSemaphore;
-
-  VkSurfaceKHR surface{};
+  // one submission renders every window, one present shows them all
+  UniqueSemaphore renderFinishedSemaphores[MAX_FRAMES_IN_FLIGHT];
+  UniqueFence inFlightFences[MAX_FRAMES_IN_FLIGHT];
+  // fence of the frame that last rendered into each slot
+  std::vector<VkFence> imagesInFlight;
+  uint32_t currentFrame = 0;
+
+  // number of frames submitted so far, used as the retire value for
+  // deletionQueue: a resource retired during frame N is destroyed once frame
+  // N has completed on the GPU
+  uint64_t frameNumber = 0;
+  DeletionQueue deletionQueue;
+
+  MemoryBudget memoryBudget;
+  FrameMetrics frameMetrics;
+  std::chrono::steady_clock::time_point lastFrameStart;
+  uint32_t frameTimeMetric = 0;
+  // usage and budget metric ids, in MiB, per memory heap
+  std::vector<uint32_t> heapUsageMetrics;
+  std::vector<uint32_t> heapBudgetMetrics;
+
+  // queries around the main pass, one per slot
+  PassQueries mainPassQueries;
+  // input assembly vertices, vertex and fragment shader invocations, clipping
+  // primitives and samples passed
+  uint32_t mainPassMetrics[5] = {};
+
+  // timestamps of every pass, for the trace and the GPU frame time
+  GpuTrace gpuTrace;
+  uint32_t gpuTimeMetric = 0;
+  // F12 on the main thread, the render thread flushes
+  bool traceKeyDown = false;
+  std::atomic<bool> traceFlushRequested{false};
 
   struct QueueFamilyIndices {
     static const uint32_t GRAPHICS; // 0b01
@@ -99,54 +355,122 @@ private:
 
 #endif
 
-  void createSurface();
+  void createSurfaces();
 
-  void selectPhysicalDevices(QueueFamilyIndices &indices,
-                             SwapChainSupportDetails &swapChainSupport);
+  void selectPhysicalDevices(QueueFamilyIndices &indices);
 
   bool isDeviceSuitable(const VkPhysicalDevice &dev,
-                        QueueFamilyIndices &indices,
-                        SwapChainSupportDetails &swapChainSupport);
+                        QueueFamilyIndices &indices);
 
   static bool checkDeviceExtensions(const VkPhysicalDevice &dev);
 
-  SwapChainSupportDetails querySwapChainSupport(const VkPhysicalDevice &dev);
+  static SwapChainSupportDetails
+  querySwapChainSupport(const VkPhysicalDevice &dev, VkSurfaceKHR surface);
 
   bool findQueueFamilies(const VkPhysicalDevice &dev,
                          Application::QueueFamilyIndices &indices);
 
   void createLogicalDevice(const QueueFamilyIndices &queueFamilyIndices);
 
-  static VkSurfaceFormatKHR chooseSwapSurfaceFormat(
-      const std::vector<VkSurfaceFormatKHR> &availableFormats);
+  void chooseBatchQueueFamilies();
+
+  VkSurfaceFormatKHR chooseSwapSurfaceFormat(
+      const std::vector<VkSurfaceFormatKHR> &availableFormats, bool first);
 
   static VkPresentModeKHR chooseSwapPresentMode(
       const std::vector<VkPresentModeKHR> &availablePresentModes);
 
   VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities);
 
-  void createSwapChain(const SwapChainSupportDetails &swapChainSupport,
-                       const QueueFamilyIndices &indices);
+  void createSwapChains(const QueueFamilyIndices &indices);
+
+  void createSwapChain(Window &window, const QueueFamilyIndices &indices);
+
+  void createImageViews(Window &window);
 
-  void createImageViews();
+  void chooseAttachmentFormats();
 
   void createRenderPass();
 
+  void createDescriptorSetLayout();
+
   void createGraphicsPipeline();
 
+  void createCullPipeline();
+
+  void createScene();
+
+  void createMeshletResources();
+
   void createFramebuffers();
 
+  void createRenderGraph(Window &window);
+
+  void recordMainPass(VkCommandBuffer commandBuffer, const Window &window,
+                      uint32_t slot);
+
+  void recordUpscale(VkCommandBuffer commandBuffer, const Window &window);
+
+  void updateRenderScale(Window &window, double gpuMilliseconds);
+
+  void recordMeshletCull(VkCommandBuffer commandBuffer, uint32_t slot,
+                         VkPipeline pipeline);
+
+  void recordDepthPrepass(VkCommandBuffer commandBuffer, const Window &window,
+                          uint32_t slot);
+
+  void updateScene(SceneSnapshot &snapshot, float time);
+
+  void updateMeshletFrame(Window &window, uint32_t slot,
+                          const SceneSnapshot &snapshot);
+
   void createCommandPool(const QueueFamilyIndices &);
 
+  void createFrameMetrics();
+
+  void recordFrameMetrics();
+
+  void recordPassQueryMetrics(uint32_t slot);
+
+  uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties);
+
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                    VkMemoryPropertyFlags properties, UniqueBuffer &buffer,
+                    UniqueDeviceMemory &memory);
+
+  // records into a new command buffer and submits it without waiting;
+  // frames go to the same queue afterwards
+  void submitOneShot(const char *what,
+                     const std::function<void(VkCommandBuffer)> &record);
+
+  void loadMesh(const std::string &path);
+
+  // the indirect draws of the slot's meshlet frame, or the placeholder
+  // triangle without a mesh
+  void buildRenderQueue(uint32_t slot);
+
+  // pushes the meshlet draws of every LOD in `drawBase` + the LOD's slots
+  void pushMeshletDraws(uint32_t slot, uint32_t pass, uint32_t pipelineId,
+                        VkPipeline pipeline, uint32_t drawBase);
+
   void createCommandBuffers();
 
-  void createSemaphores();
+  void recordCommandBuffer(Window &window, uint32_t imageIndex);
+
+  void createSyncObjects();
 
   VkShaderModule createShaderModule(const std::vector<char> &code);
 
+  bool windowClosed() const;
+
+  // handles window events while the simulation and render threads run
   void mainLoop();
 
-  void drawFrame();
+  void simulationLoop();
+
+  void renderLoop();
+
+  void drawFrame(const SceneSnapshot &snapshot);
 
   void cleanUp();
 };
@@ -0,0 +1,128 @@
+#ifndef MYVK_COMPUTE_BATCH_H
+#define MYVK_COMPUTE_BATCH_H
+
+#include "vk_handle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Runs compute shaders over host memory without a window, many jobs in a
+// row. Each job uploads its inputs on the transfer queue, dispatches on the
+// compute queue and downloads its outputs on the transfer queue again. Two
+// sets of device and staging buffers are used in turn, so the dispatch of
+// one job overlaps the download of the previous one and the upload of the
+// next. With a single queue family the stages still run in order, without
+// the overlap.
+class ComputeBatch {
+public:
+  // a storage buffer at binding i of set 0 for the i-th binding of a job
+  struct Binding {
+    VkDeviceSize size;
+    // copied into the buffer before the dispatch unless null
+    const void *input;
+    // receives the buffer after the dispatch unless null
+    void *output;
+  };
+
+  struct Job {
+    // a SPIR-V compute shader file, turned into a pipeline on first use
+    std::string shader;
+    std::vector<Binding> bindings;
+    uint32_t groupCount[3];
+  };
+
+  struct Stats {
+    uint32_t jobs;
+    // uploaded plus downloaded
+    VkDeviceSize bytes;
+    double seconds;
+    double gigabytesPerSecond;
+  };
+
+  static const uint32_t MAX_BINDINGS = 8;
+
+  // the queues are the first of their families
+  void create(VkPhysicalDevice physicalDevice, VkDevice device,
+              uint32_t computeFamily, uint32_t transferFamily);
+
+  void destroy();
+
+  // returns once the outputs of every job are written; jobs beyond the
+  // device's dispatch or storage buffer limits are skipped with an error
+  Stats run(const std::vector<Job> &jobs);
+
+private:
+  static const uint32_t SLOTS = 2;
+
+  struct Pipeline {
+    uint32_t bindingCount = 0;
+    UniqueDescriptorSetLayout setLayout;
+    UniquePipelineLayout layout;
+    UniquePipeline pipeline;
+  };
+
+  struct Buffer {
+    UniqueBuffer buffer;
+    UniqueDeviceMemory memory;
+    VkDeviceSize size = 0;
+    // persistently mapped for staging buffers
+    void *data = nullptr;
+  };
+
+  // everything one job in flight uses
+  struct Slot {
+    Buffer bindings[MAX_BINDINGS];
+    Buffer upload;
+    Buffer download;
+    UniqueDescriptorPool descriptorPool;
+    VkCommandBuffer uploadCommands = VK_NULL_HANDLE;
+    VkCommandBuffer dispatchCommands = VK_NULL_HANDLE;
+    VkCommandBuffer downloadCommands = VK_NULL_HANDLE;
+    UniqueSemaphore uploaded;
+    UniqueSemaphore dispatched;
+    // signaled by the download
+    UniqueFence done;
+    // whose outputs wait in `download` until `done`, null if none
+    const Job *pending = nullptr;
+  };
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t families[2] = {};
+  VkQueue computeQueue = VK_NULL_HANDLE;
+  VkQueue transferQueue = VK_NULL_HANDLE;
+  uint32_t maxGroupCount[3] = {};
+  uint32_t maxStorageBufferRange = 0;
+  UniqueCommandPool computePool;
+  UniqueCommandPool transferPool;
+  Slot slots[SLOTS];
+  std::map<std::string, Pipeline> pipelines;
+
+  bool withinLimits(const Job &job) const;
+
+  const Pipeline *pipelineFor(const Job &job);
+
+  // grows `buffer` to at least `size` bytes; device local unless `host`
+  bool reserve(Buffer &buffer, VkDeviceSize size, VkBufferUsageFlags usage,
+               bool host);
+
+  // waits for the slot's last job and copies out its outputs
+  void retire(Slot &slot);
+
+  bool submitUpload(Slot &slot, const Job &job);
+
+  bool submitDispatch(Slot &slot, const Job &job, const Pipeline &pipeline);
+
+  bool submitDownload(Slot &slot, const Job &job);
+
+  // after a failed dispatch or download: consumes the pending signal of
+  // `semaphore` on `queue` and signals `done`, so retire() waits for the
+  // slot's submitted work before the slot is reused
+  void drain(Slot &slot, VkQueue queue, UniqueSemaphore &semaphore);
+};
+
+#endif // MYVK_COMPUTE_BATCH_H
@@ -0,0 +1,33 @@
+#ifndef MYVK_DELETION_QUEUE_H
+#define MYVK_DELETION_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+// Holds destroy callbacks until the GPU work that may still reference the
+// objects has retired. Each entry is keyed by a monotonically increasing value
+// (a frame number or a timeline semaphore value); collect() runs every entry
+// whose key is <= the last value known to be complete.
+class DeletionQueue {
+public:
+  void push(uint64_t retireValue, std::function<void()> deleter);
+
+  void collect(uint64_t completedValue);
+
+  // runs every pending deleter, only valid once the device is idle
+  void flush();
+
+  inline size_t size() const { return entries.size(); }
+
+private:
+  struct Entry {
+    uint64_t retireValue;
+    std::function<void()> deleter;
+  };
+
+  std::deque<Entry> entries;
+};
+
+#endif // MYVK_DELETION_QUEUE_H
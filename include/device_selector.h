@@ -0,0 +1,61 @@
+#ifndef MYVK_DEVICE_SELECTOR_H
+#define MYVK_DEVICE_SELECTOR_H
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Picks the fastest of several suitable physical devices. Every candidate
+// gets a static score from its type, device local memory and limits. When
+// benchmarking is allowed and more than one device qualifies, each one also
+// runs a short clear and compute workload on its own temporary device, and
+// the benchmark times decide. Times are cached in a file keyed by
+// deviceUUID, so later launches with the same devices do not probe again.
+class DeviceSelector {
+public:
+  struct Candidate {
+    VkPhysicalDevice device;
+    // queue family the benchmark runs on, must support graphics; without
+    // compute only the clears are timed
+    uint32_t queueFamily;
+  };
+
+  // the instance must have VK_KHR_get_physical_device_properties2 enabled
+  DeviceSelector(VkInstance instance, std::string cachePath);
+
+  // returns an index into candidates, or -1 if there are none
+  int select(const std::vector<Candidate> &candidates, bool benchmark);
+
+  // higher is better; the device type dominates, then device local memory
+  static uint64_t staticScore(VkPhysicalDevice device);
+
+private:
+  using Uuid = std::array<uint8_t, VK_UUID_SIZE>;
+
+  // clears of a 2048x2048 RGBA8 image and dispatches of the benchmark shader
+  static const uint32_t BENCH_CLEARS = 32;
+  static const uint32_t BENCH_DISPATCHES = 8;
+  static const uint32_t BENCH_INVOCATIONS = 1U << 20;
+
+  PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = nullptr;
+  std::string cachePath;
+  // milliseconds per device, negative if its benchmark failed
+  std::map<Uuid, double> cachedTimes;
+
+  // deviceUUID, or pipelineCacheUUID without properties2; the latter also
+  // changes with the driver version, which only costs a new benchmark
+  Uuid deviceUuid(VkPhysicalDevice device) const;
+
+  static double benchmark(const Candidate &candidate);
+
+  void loadCache();
+
+  void saveCache() const;
+};
+
+#endif // MYVK_DEVICE_SELECTOR_H
@@ -0,0 +1,35 @@
+#ifndef MYVK_FRAME_METRICS_H
+#define MYVK_FRAME_METRICS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-frame values averaged over a window of frames and logged together, one
+// line per window, so frame times line up with the other counters.
+class FrameMetrics {
+public:
+  explicit FrameMetrics(uint32_t window = 300) : window(window) {}
+
+  // registers a metric and returns the id to record it with
+  uint32_t add(std::string name);
+
+  void record(uint32_t id, double value);
+
+  // closes the current frame; logs and resets once `window` frames are in
+  void endFrame();
+
+private:
+  struct Metric {
+    std::string name;
+    double sum;
+    double max;
+    uint32_t samples;
+  };
+
+  uint32_t window;
+  uint32_t frames = 0;
+  std::vector<Metric> metrics;
+};
+
+#endif // MYVK_FRAME_METRICS_H
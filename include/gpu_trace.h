@@ -0,0 +1,78 @@
+#ifndef MYVK_GPU_TRACE_H
+#define MYVK_GPU_TRACE_H
+
+#include "vk_handle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Timestamp ranges recorded into pre-recorded command buffers, one query slot
+// per buffer, and read back without stalling into the trace's GPU track. GPU
+// ticks are mapped onto the traceNow() clock with VK_EXT_calibrated_timestamps
+// when available, otherwise by timing one submission at start up.
+class GpuTrace {
+public:
+  // each slot holds up to `maxRanges` ranges; `calibratedTimestamps` says
+  // whether VK_EXT_calibrated_timestamps is enabled on the device
+  void create(VkInstance instance, VkPhysicalDevice physicalDevice,
+              VkDevice device, uint32_t queueFamily, uint32_t slots,
+              uint32_t maxRanges, bool calibratedTimestamps);
+
+  void destroy();
+
+  // maps GPU ticks to CPU time; `queue` and `commandPool` are only used
+  // without calibrated timestamps
+  void calibrate(VkQueue queue, VkCommandPool commandPool);
+
+  // recorded first in a command buffer, outside of any render pass
+  void reset(VkCommandBuffer commandBuffer, uint32_t slot);
+
+  // ranges may nest; each end() closes the innermost open range
+  void begin(VkCommandBuffer commandBuffer, uint32_t slot,
+             const std::string &name);
+  void end(VkCommandBuffer commandBuffer, uint32_t slot);
+
+  void submitted(uint32_t slot);
+
+  // emits the ranges of the slot's last submission and returns the time
+  // between its first and last timestamp; false if nothing is ready
+  bool collect(uint32_t slot, double &milliseconds);
+
+  inline bool enabled() const { return static_cast<bool>(queryPool); }
+
+private:
+  struct Range {
+    const char *name;
+    uint32_t beginQuery;
+    uint32_t endQuery;
+  };
+
+  struct Slot {
+    std::vector<Range> ranges;
+    std::vector<uint32_t> open;
+    uint32_t queries = 0;
+    bool pending = false;
+  };
+
+  // frames between two calibrations, to follow clock drift
+  static const uint32_t CALIBRATION_INTERVAL = 256;
+
+  bool calibrateWithExtension();
+
+  VkDevice device = VK_NULL_HANDLE;
+  UniqueQueryPool queryPool;
+  uint32_t maxRanges = 0;
+  double period = 1.0;
+  uint64_t validMask = ~0ULL;
+  PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps = nullptr;
+  // traceNow() - GPU nanoseconds
+  int64_t offset = 0;
+  uint32_t collectsSinceCalibration = 0;
+  std::vector<Slot> slots;
+  std::vector<uint64_t> results;
+};
+
+#endif // MYVK_GPU_TRACE_H
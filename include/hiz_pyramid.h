@@ -0,0 +1,80 @@
+#ifndef MYVK_HIZ_PYRAMID_H
+#define MYVK_HIZ_PYRAMID_H
+
+#include "vk_handle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// A min/max depth pyramid for occlusion culling. Level 0 is half the size of
+// the depth buffer it is reduced from, rounded up, and every further level
+// halves again down to 1x1; each texel holds the nearest (r) and farthest (g)
+// depth of the pixels it covers. The pyramid outlives the frame: it is
+// cleared to "nothing is occluded" on creation and otherwise kept in
+// SHADER_READ_ONLY_OPTIMAL, where culling samples it through view().
+class HiZPyramid {
+public:
+  static const VkFormat FORMAT = VK_FORMAT_R32G32_SFLOAT;
+  // of the depth buffers reduced into a pyramid
+  static const VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+
+  // the rg32f storage image also needs the shaderStorageImageExtendedFormats
+  // feature enabled
+  static bool supported(VkPhysicalDevice physicalDevice);
+
+  // sized for a depth buffer of `depthExtent`
+  void create(VkPhysicalDevice physicalDevice, VkDevice device,
+              VkExtent2D depthExtent);
+
+  void destroy();
+
+  // the depth buffer level 0 is reduced from, in SHADER_READ_ONLY_OPTIMAL
+  void setDepth(VkImageView depthView);
+
+  // moves a new pyramid from UNDEFINED to SHADER_READ_ONLY_OPTIMAL, with the
+  // farthest depth everywhere so the first frame occludes nothing
+  void recordClear(VkCommandBuffer commandBuffer);
+
+  // Reduces the depth buffer into every level, one dispatch per level. The
+  // pyramid must be in GENERAL and stays there; the last level is left
+  // without a barrier.
+  void recordReduce(VkCommandBuffer commandBuffer);
+
+  inline VkImage image() const { return pyramid; }
+  // all levels, for sampling with texelFetch
+  inline VkImageView view() const { return pyramidView; }
+  inline VkSampler sampler() const { return nearestSampler; }
+  inline VkExtent2D extent() const { return levelExtents.front(); }
+  inline uint32_t levelCount() const {
+    return static_cast<uint32_t>(levelExtents.size());
+  }
+
+private:
+  static const uint32_t GROUP_SIZE = 8;
+
+  struct ReduceConstants {
+    int32_t sourceSize[2];
+    uint32_t fromDepth;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkExtent2D depthExtent = {};
+  std::vector<VkExtent2D> levelExtents;
+
+  UniqueImage pyramid;
+  UniqueDeviceMemory memory;
+  UniqueImageView pyramidView;
+  std::vector<UniqueImageView> levelViews;
+  UniqueSampler nearestSampler;
+
+  UniqueDescriptorSetLayout setLayout;
+  UniquePipelineLayout pipelineLayout;
+  UniquePipeline reducePipeline;
+  UniqueDescriptorPool descriptorPool;
+  // level i reads level i - 1, level 0 reads the depth buffer
+  std::vector<VkDescriptorSet> levelSets;
+};
+
+#endif // MYVK_HIZ_PYRAMID_H
@@ -0,0 +1,44 @@
+#ifndef MYVK_HOST_ALLOCATOR_H
+#define MYVK_HOST_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// one slot per VkSystemAllocationScope, COMMAND through INSTANCE
+const uint32_t HOST_ALLOCATION_SCOPES = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+// Counters for one VkSystemAllocationScope. `internal*` track the driver's
+// own allocations reported through the internal allocation notifications.
+struct HostAllocationScopeStats {
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t liveAllocations;
+  uint64_t liveBytes;
+  uint64_t peakBytes;
+  uint64_t internalBytes;
+};
+
+struct HostAllocatorStats {
+  HostAllocationScopeStats scopes[HOST_ALLOCATION_SCOPES];
+  // bytes reserved from the system by the arenas and the size-class pools
+  uint64_t arenaBytes;
+  uint64_t poolBytes;
+};
+
+// Allocation callbacks to pass as pAllocator to every create and destroy
+// call. Command scope allocations are bumped from a per-thread arena that is
+// rewound once everything it handed out is freed; longer lived scopes come
+// from power-of-two size-class pools, and anything too large for either goes
+// to malloc. Returns nullptr when built with MYVK_SYSTEM_HOST_ALLOCATOR so
+// the driver's default allocator can be compared against.
+const VkAllocationCallbacks *hostAllocator();
+
+HostAllocatorStats hostAllocatorStats();
+
+// logs the per-scope counters; allocations still live are reported as a
+// warning, which after vkDestroyInstance means something leaked
+void logHostAllocatorStats();
+
+#endif // MYVK_HOST_ALLOCATOR_H
@@ -0,0 +1,88 @@
+#ifndef MYVK_JOB_SYSTEM_H
+#define MYVK_JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing job scheduler. Every worker thread owns a deque: it pushes
+// and pops its own jobs at the back, and when that runs dry steals from the
+// front of the others. Threads outside the pool push to one shared deque.
+// Jobs are grouped by a Counter; wait() keeps the calling thread running
+// queued jobs until the group is done, so jobs may wait on jobs they spawn
+// without blocking a worker. Idle workers sleep until something is queued.
+class JobSystem {
+public:
+  typedef std::function<void()> Job;
+
+  // the number of unfinished jobs of a group
+  class Counter {
+  public:
+    Counter() : pending(0) {}
+
+    inline bool done() const {
+      return pending.load(std::memory_order_acquire) == 0;
+    }
+
+  private:
+    friend class JobSystem;
+    std::atomic<uint32_t> pending;
+  };
+
+  explicit JobSystem(uint32_t workerCount);
+
+  // runs what is still queued, then joins the workers
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // `counter` must outlive the job
+  void run(Counter &counter, Job job);
+
+  void wait(const Counter &counter);
+
+  inline uint32_t workerCount() const {
+    return static_cast<uint32_t>(workers.size());
+  }
+
+private:
+  struct Task {
+    Job job;
+    Counter *counter;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // one per worker, then the shared one
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  // tasks in all queues, what sleeping workers wait for
+  std::atomic<uint32_t> queued;
+  std::atomic<bool> stopping;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+
+  // index into `queues` of the calling thread
+  uint32_t ownQueue() const;
+
+  // runs one task: the newest of `own`, else the oldest of another queue
+  bool runOne(uint32_t own);
+
+  void workerLoop(uint32_t index);
+};
+
+// The process-wide job system with hardware_concurrency() - 1 workers, the
+// submitting thread being the last core. Started on first use.
+JobSystem &jobSystem();
+
+#endif // MYVK_JOB_SYSTEM_H
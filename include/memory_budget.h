@@ -0,0 +1,71 @@
+#ifndef MYVK_MEMORY_BUDGET_H
+#define MYVK_MEMORY_BUDGET_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Drop-in replacements for vkAllocateMemory and vkFreeMemory that keep a
+// per-heap total of the device memory this process allocated. The heap of
+// each memory type is taken from the last MemoryBudget::create() call.
+VkResult VKAPI_PTR
+allocateDeviceMemory(VkDevice device, const VkMemoryAllocateInfo *allocateInfo,
+                     const VkAllocationCallbacks *allocator,
+                     VkDeviceMemory *memory);
+
+void VKAPI_PTR freeDeviceMemory(VkDevice device, VkDeviceMemory memory,
+                                const VkAllocationCallbacks *allocator);
+
+struct MemoryHeapBudget {
+  VkDeviceSize size;
+  // from VK_EXT_memory_budget when enabled; otherwise the heap size and the
+  // bytes allocated through allocateDeviceMemory
+  VkDeviceSize budget;
+  VkDeviceSize usage;
+  // bytes allocated through allocateDeviceMemory
+  VkDeviceSize allocated;
+  bool deviceLocal;
+};
+
+// Samples device memory usage once a frame. When a heap goes over PRESSURE of
+// its budget, the eviction callbacks are asked in registration order to free
+// enough to bring it back to TARGET.
+class MemoryBudget {
+public:
+  // asked to release about `bytes` from `heap`, returns the bytes released;
+  // memory handed to a deletion queue counts once it is actually freed
+  using EvictCallback =
+      std::function<VkDeviceSize(uint32_t heap, VkDeviceSize bytes)>;
+
+  static constexpr float PRESSURE = 0.9f;
+  static constexpr float TARGET = 0.8f;
+
+  void create(VkInstance instance, VkPhysicalDevice physicalDevice,
+              bool budgetExtension);
+
+  void addEvictCallback(EvictCallback callback);
+
+  void sample();
+
+  inline uint32_t heapCount() const {
+    return static_cast<uint32_t>(heaps.size());
+  }
+  inline const MemoryHeapBudget &heap(uint32_t index) const {
+    return heaps[index];
+  }
+
+private:
+  // samples a heap is left alone after an eviction, so frees that are still
+  // waiting on in-flight frames are not requested twice
+  static const uint32_t EVICTION_COOLDOWN = 4;
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+  std::vector<MemoryHeapBudget> heaps;
+  std::vector<uint32_t> cooldown;
+  std::vector<EvictCallback> evictCallbacks;
+};
+
+#endif // MYVK_MEMORY_BUDGET_H
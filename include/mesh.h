@@ -0,0 +1,143 @@
+#ifndef MYVK_MESH_H
+#define MYVK_MESH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary mesh container (.mvm), little endian:
+//
+//   MeshHeader
+//   section   offset                 size
+//   vertex    header.vertexOffset    vertexCount * sizeof(PackedVertex)
+//   index     header.indexOffset     indexCount * header.indexSize
+//   lod       header.lodOffset       lodCount * sizeof(MeshLod)
+//   meshlet   header.meshletOffset   meshletCount * sizeof(Meshlet)
+//
+// All sections start on a MESH_SECTION_ALIGNMENT boundary and are already in
+// the layout the GPU reads, so loading is an mmap plus a memcpy per section.
+// The index section holds the triangles of every LOD, grouped by meshlet.
+static const char MESH_MAGIC[4] = {'M', 'Y', 'V', 'M'};
+static const uint32_t MESH_VERSION = 2;
+static const uint64_t MESH_SECTION_ALIGNMENT = 256;
+static const uint32_t MESH_MAX_LODS = 8;
+
+struct MeshHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t vertexStride;
+  // 2 or 4 bytes
+  uint32_t indexSize;
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  // positions are stored as unorm16 relative to this box
+  float boundsMin[3];
+  float boundsMax[3];
+  uint32_t lodCount;
+  uint32_t meshletCount;
+  uint64_t lodOffset;
+  uint64_t meshletOffset;
+};
+
+// A cluster of at most MESHLET_MAX_VERTICES vertices and
+// MESHLET_MAX_TRIANGLES triangles, laid out as the culling shader reads it
+// (std430). The bounds are in the unquantized mesh space.
+struct Meshlet {
+  float center[3];
+  float radius;
+  // the meshlet is back facing for every viewer at `position` with
+  //   dot(center - position, coneAxis) >=
+  //       coneCutoff * length(center - position) + radius
+  // a cutoff of 1 never culls
+  float coneAxis[3];
+  float coneCutoff;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  uint32_t vertexCount;
+  uint32_t padding;
+};
+
+// One level of detail: a range of meshlets and the largest distance any
+// vertex moved relative to LOD 0, in mesh space.
+struct MeshLod {
+  uint32_t firstMeshlet;
+  uint32_t meshletCount;
+  uint32_t indexCount;
+  float error;
+};
+
+// 16 bytes per vertex:
+//   position  R16G16B16A16_UNORM, dequantized with the header bounds
+//   normal    R8G8B8A8_SNORM
+//   uv        R16G16_SFLOAT
+struct PackedVertex {
+  uint16_t position[4];
+  int8_t normal[4];
+  uint16_t uv[2];
+};
+
+// Uncompressed vertex used by the offline tools before quantization.
+struct MeshVertex {
+  float position[3];
+  float normal[3];
+  float uv[2];
+};
+
+uint16_t floatToHalf(float value);
+
+// Quantizes `vertices` against their bounding box, filling the bounds of
+// `header`.
+std::vector<PackedVertex>
+quantizeVertices(const std::vector<MeshVertex> &vertices, MeshHeader &header);
+
+void writeMesh(const std::string &filename,
+               const std::vector<PackedVertex> &vertices,
+               const std::vector<uint32_t> &indices,
+               const std::vector<MeshLod> &lods,
+               const std::vector<Meshlet> &meshlets, MeshHeader header);
+
+// Read-only memory mapping of a .mvm file. Throws std::runtime_error if the
+// file cannot be opened or is not a valid mesh.
+class MappedMesh {
+public:
+  explicit MappedMesh(const std::string &filename);
+  ~MappedMesh();
+
+  MappedMesh(const MappedMesh &) = delete;
+  MappedMesh &operator=(const MappedMesh &) = delete;
+
+  inline const MeshHeader &header() const {
+    return *reinterpret_cast<const MeshHeader *>(data);
+  }
+  inline const void *vertexData() const {
+    return data + header().vertexOffset;
+  }
+  inline size_t vertexDataSize() const {
+    return static_cast<size_t>(header().vertexCount) * header().vertexStride;
+  }
+  inline const void *indexData() const { return data + header().indexOffset; }
+  inline size_t indexDataSize() const {
+    return static_cast<size_t>(header().indexCount) * header().indexSize;
+  }
+  inline const MeshLod *lods() const {
+    return reinterpret_cast<const MeshLod *>(data + header().lodOffset);
+  }
+  inline const Meshlet *meshlets() const {
+    return reinterpret_cast<const Meshlet *>(data + header().meshletOffset);
+  }
+  inline size_t meshletDataSize() const {
+    return static_cast<size_t>(header().meshletCount) * sizeof(Meshlet);
+  }
+
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+#ifdef __WIN32__
+  std::vector<char> buffer;
+#endif
+};
+
+#endif // MYVK_MESH_H
@@ -0,0 +1,53 @@
+#ifndef MYVK_MESH_OPTIMIZER_H
+#define MYVK_MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reorders the triangles of an indexed triangle list so consecutive
+// triangles reuse vertices still in the post-transform cache (Tom Forsyth's
+// linear-speed vertex cache optimisation).
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+// Renumbers vertices in the order the index buffer first references them so
+// vertex fetches walk memory linearly. Rewrites `indices` and returns the
+// remap table (old index -> new index, ~0u for unreferenced vertices).
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t> &indices,
+                                          size_t vertexCount);
+
+// Applies a remap table returned by optimizeVertexFetch, dropping
+// unreferenced vertices.
+template <typename T>
+std::vector<T> remapVertices(const std::vector<T> &vertices,
+                             const std::vector<uint32_t> &remap) {
+  size_t count = 0;
+  for (uint32_t r : remap) {
+    if (r != ~0U) {
+      ++count;
+    }
+  }
+  std::vector<T> result(count);
+  for (size_t i = 0; i < remap.size(); ++i) {
+    if (remap[i] != ~0U) {
+      result[remap[i]] = vertices[i];
+    }
+  }
+  return result;
+}
+
+// Simplifies by vertex clustering: vertices are snapped to a grid with
+// `gridSize` cells along the longest side of their bounds, and each cell
+// collapses onto the vertex nearest the centroid of the cell's vertices.
+// Triangles that become degenerate are dropped. The result indexes the same
+// vertex array; `error` receives the largest distance a vertex moved.
+std::vector<uint32_t> simplifyClustered(const std::vector<uint32_t> &indices,
+                                        const std::vector<float> &positions,
+                                        uint32_t gridSize, float &error);
+
+// Average cache miss ratio (transformed vertices per triangle) of a FIFO
+// post-transform cache; 0.5 is ideal for a regular grid, 3 is worst case.
+float computeAcmr(const std::vector<uint32_t> &indices, size_t vertexCount,
+                  uint32_t cacheSize = 16);
+
+#endif // MYVK_MESH_OPTIMIZER_H
@@ -0,0 +1,26 @@
+#ifndef MYVK_MESHLET_H
+#define MYVK_MESHLET_H
+
+#include "mesh.h"
+
+#include <cstdint>
+#include <vector>
+
+static const uint32_t MESHLET_MAX_VERTICES = 64;
+static const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// Splits an indexed triangle list into meshlets by walking the triangles in
+// order and starting a new meshlet whenever the vertex or triangle limit
+// would be exceeded, so the triangle order is kept and a cache optimized list
+// gives compact clusters. `positions` holds xyz per vertex. firstIndex of the
+// returned meshlets is relative to the start of `indices`.
+std::vector<Meshlet> buildMeshlets(const std::vector<uint32_t> &indices,
+                                   const std::vector<float> &positions);
+
+// Fills the bounding sphere and normal cone of `meshlet` from its
+// `indexCount` indices.
+void computeMeshletBounds(const uint32_t *indices, uint32_t indexCount,
+                          const std::vector<float> &positions,
+                          Meshlet &meshlet);
+
+#endif // MYVK_MESHLET_H
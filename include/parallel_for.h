@@ -0,0 +1,15 @@
+#ifndef MYVK_PARALLEL_FOR_H
+#define MYVK_PARALLEL_FOR_H
+
+#include <cstdint>
+#include <functional>
+
+// Runs body(begin, end) over [0, count) split into ranges of `grain` items,
+// on the calling thread plus up to every worker of jobSystem(), all pulling
+// ranges from a shared counter. Returns once every range is done; the
+// calling thread runs other queued jobs while it waits. Small counts run
+// inline.
+void parallelFor(uint32_t count, uint32_t grain,
+                 const std::function<void(uint32_t, uint32_t)> &body);
+
+#endif // MYVK_PARALLEL_FOR_H
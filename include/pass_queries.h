@@ -0,0 +1,52 @@
+#ifndef MYVK_PASS_QUERIES_H
+#define MYVK_PASS_QUERIES_H
+
+#include "vk_handle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// Pipeline statistics and occlusion queries wrapped around a pass. Each
+// pre-recorded command buffer gets its own query slot, which it resets
+// itself, so results are read back without stalling once the GPU has finished
+// with that buffer.
+class PassQueries {
+public:
+  struct Results {
+    bool statistics;
+    uint64_t inputAssemblyVertices;
+    uint64_t vertexShaderInvocations;
+    uint64_t clippingPrimitives;
+    uint64_t fragmentShaderInvocations;
+    // exact only with a precise occlusion query, otherwise just non-zero
+    uint64_t samplesPassed;
+  };
+
+  // statistics need the pipelineStatisticsQuery feature, precise sample
+  // counts the occlusionQueryPrecise feature
+  void create(VkDevice device, uint32_t slots, bool statistics, bool precise);
+
+  void destroy();
+
+  // both are recorded outside of any render pass instance
+  void begin(VkCommandBuffer commandBuffer, uint32_t slot);
+  void end(VkCommandBuffer commandBuffer, uint32_t slot);
+
+  // marks the slot as submitted; results of a slot are only read after this
+  void submitted(uint32_t slot);
+
+  // returns false if the slot was never submitted or its results are not
+  // available yet
+  bool read(uint32_t slot, Results &results);
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  UniqueQueryPool statisticsPool;
+  UniqueQueryPool occlusionPool;
+  VkQueryControlFlags occlusionFlags = 0;
+  std::vector<bool> pending;
+};
+
+#endif // MYVK_PASS_QUERIES_H
@@ -0,0 +1,209 @@
+#ifndef MYVK_RENDER_GRAPH_H
+#define MYVK_RENDER_GRAPH_H
+
+#include "vk_handle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How a pass touches an image. Each usage maps to the pipeline stage, access
+// mask, layout and image usage flag the graph needs to derive barriers.
+enum class ResourceUsage {
+  ColorAttachment,
+  DepthAttachment,
+  DepthRead,
+  SampledFragment,
+  SampledCompute,
+  Storage,
+  TransferSrc,
+  TransferDst,
+};
+
+// A small frame graph. Passes declare which images they read and write; on
+// compile() the graph
+//   - culls passes that contribute nothing to an imported image,
+//   - derives the minimal set of image barriers and layout transitions
+//     between the surviving passes,
+//   - creates the transient images and places those whose lifetimes do not
+//     overlap into the same VkDeviceMemory.
+// execute() then records the barriers and each pass's commands.
+class RenderGraph {
+public:
+  typedef uint32_t ResourceId;
+  // second argument is the index handed to execute(), e.g. the swap chain
+  // image the command buffer is recorded for
+  typedef std::function<void(VkCommandBuffer, uint32_t)> RecordFunc;
+  // called around every pass execute() records, with the pass name and true
+  // before and false after it, e.g. to wrap passes in GPU timestamps
+  typedef std::function<void(VkCommandBuffer, uint32_t, const std::string &,
+                             bool)>
+      PassObserver;
+
+  struct ImageDesc {
+    VkFormat format;
+    VkExtent2D extent;
+    VkSampleCountFlagBits samples;
+  };
+
+  class PassBuilder {
+  public:
+    PassBuilder &read(ResourceId resource, ResourceUsage usage);
+    PassBuilder &write(ResourceId resource, ResourceUsage usage);
+    // keep the pass even if none of its outputs are consumed
+    PassBuilder &sideEffects();
+
+  private:
+    friend class RenderGraph;
+    PassBuilder(RenderGraph &graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+    RenderGraph &graph;
+    uint32_t pass;
+  };
+
+  ~RenderGraph() { reset(); }
+
+  // An image owned outside the graph (e.g. a swap chain image). It is a
+  // graph output: passes writing it are never culled. The image is expected
+  // in `initialLayout` after `initialStage` and left in `finalLayout`.
+  ResourceId importImage(const std::string &name, const ImageDesc &desc,
+                         VkImageLayout initialLayout,
+                         VkPipelineStageFlags initialStage,
+                         VkImageLayout finalLayout);
+
+  // An image that lives only inside the graph. Its VkImageUsageFlags are
+  // derived from the passes that use it.
+  ResourceId createImage(const std::string &name, const ImageDesc &desc);
+
+  // A transient image that is only a render target, such as depth or a
+  // multisampled color target resolved in its pass. It gets
+  // TRANSIENT_ATTACHMENT usage and lazily allocated memory where the device
+  // has it, so a tiler may keep it in tile memory and never back it at all.
+  ResourceId createAttachment(const std::string &name, const ImageDesc &desc);
+
+  PassBuilder addPass(const std::string &name, RecordFunc record);
+
+  void compile(VkPhysicalDevice physicalDevice, VkDevice device);
+
+  void bindImage(ResourceId resource, VkImage image, VkImageView view);
+
+  inline VkImage getImage(ResourceId resource) const {
+    return resources[resource].image;
+  }
+  inline VkImageView getImageView(ResourceId resource) const {
+    return resources[resource].view;
+  }
+
+  void execute(VkCommandBuffer commandBuffer, uint32_t index) const;
+
+  inline void setPassObserver(PassObserver observer) {
+    passObserver = std::move(observer);
+  }
+
+  // With vkCmdPipelineBarrier2 (synchronization2) every image barrier
+  // carries its own stages instead of sharing those of its batch; nullptr
+  // records vkCmdPipelineBarrier
+  inline void setPipelineBarrier2(PFN_vkCmdPipelineBarrier2 function) {
+    pipelineBarrier2 = function;
+  }
+
+  // bytes allocated from lazily allocated memory types, and how many of them
+  // the device has actually committed
+  VkDeviceSize lazyMemorySize() const { return lazySize; }
+  VkDeviceSize lazyCommitment(VkDevice device) const;
+
+  // destroys transient images and memory and forgets all passes
+  void reset();
+
+private:
+  struct Access {
+    ResourceId resource;
+    ResourceUsage usage;
+    bool write;
+  };
+
+  struct Pass {
+    std::string name;
+    RecordFunc record;
+    std::vector<Access> accesses;
+    bool sideEffects = false;
+    bool culled = false;
+  };
+
+  struct Resource {
+    std::string name;
+    ImageDesc desc;
+    bool imported = false;
+    bool attachment = false;
+    VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags initialStage = 0;
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageUsageFlags usage = 0;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    // first and last position in `order` using the resource, -1 if unused
+    int firstUse = -1;
+    int lastUse = -1;
+    int memoryBlock = -1;
+  };
+
+  struct Barrier {
+    ResourceId resource;
+    VkPipelineStageFlags srcStages;
+    VkPipelineStageFlags dstStages;
+    VkAccessFlags srcAccess;
+    VkAccessFlags dstAccess;
+    VkImageLayout oldLayout;
+    VkImageLayout newLayout;
+  };
+
+  struct BarrierBatch {
+    VkPipelineStageFlags srcStages = 0;
+    VkPipelineStageFlags dstStages = 0;
+    std::vector<Barrier> barriers;
+  };
+
+  struct MemoryBlock {
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeBits = ~0U;
+    // holds attachments only, and got a lazily allocated memory type
+    bool attachment = false;
+    bool lazy = false;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    // transient resources placed in this block, ordered by first use
+    std::vector<ResourceId> occupants;
+  };
+
+  std::vector<Pass> passes;
+  std::vector<Resource> resources;
+  PassObserver passObserver;
+  PFN_vkCmdPipelineBarrier2 pipelineBarrier2 = nullptr;
+
+  // indices into `passes` of the passes that survived culling, and the
+  // barriers recorded before each of them
+  std::vector<uint32_t> order;
+  std::vector<BarrierBatch> passBarriers;
+  BarrierBatch finalBarriers;
+
+  std::vector<MemoryBlock> memoryBlocks;
+  VkDeviceSize lazySize = 0;
+  std::vector<UniqueImage> transientImages;
+  std::vector<UniqueImageView> transientViews;
+  std::vector<UniqueDeviceMemory> transientMemory;
+
+  void cullPasses();
+
+  void computeLifetimes();
+
+  void allocateTransients(VkPhysicalDevice physicalDevice, VkDevice device);
+
+  void computeBarriers();
+
+  void recordBarriers(VkCommandBuffer commandBuffer,
+                      const BarrierBatch &batch) const;
+};
+
+#endif // MYVK_RENDER_GRAPH_H
@@ -0,0 +1,84 @@
+#ifndef MYVK_RENDER_QUEUE_H
+#define MYVK_RENDER_QUEUE_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// Everything needed to record one draw. Handles left as VK_NULL_HANDLE are
+// not bound; a draw with an index buffer is recorded with vkCmdDrawIndexed,
+// one with an indirect buffer with the matching indirect command.
+struct DrawPacket {
+  uint64_t sortKey = 0;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;
+  VkDeviceSize vertexBufferOffset = 0;
+  // per instance data at binding 1
+  VkBuffer instanceBuffer = VK_NULL_HANDLE;
+  VkDeviceSize instanceBufferOffset = 0;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  VkDeviceSize indexBufferOffset = 0;
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+  // tightly packed commands, `count` of them
+  VkBuffer indirectBuffer = VK_NULL_HANDLE;
+  VkDeviceSize indirectOffset = 0;
+  // vertex count, index count for indexed draws, or command count for
+  // indirect draws
+  uint32_t count = 0;
+  uint32_t instanceCount = 1;
+  // first vertex, or first index for indexed draws
+  uint32_t first = 0;
+  int32_t vertexOffset = 0;
+  uint32_t firstInstance = 0;
+};
+
+// Collects draw packets for a frame, radix sorts them by their 64-bit key and
+// records them while skipping state that is already bound.
+//
+// Key layout, most significant first, so that the most expensive state
+// changes happen least often:
+//   [63:60] pass  [59:48] pipeline  [47:32] descriptor set  [31:0] depth
+class RenderQueue {
+public:
+  struct Stats {
+    uint32_t draws = 0;
+    uint32_t pipelineBinds = 0;
+    uint32_t descriptorSetBinds = 0;
+    uint32_t vertexBufferBinds = 0;
+    uint32_t indexBufferBinds = 0;
+  };
+
+  // `pipeline` and `descriptorSet` are small ids chosen by the caller, not
+  // handles; `pass` selects the flush() that records the packet. Depth is
+  // sorted front to back unless `backToFront` is set.
+  static uint64_t makeSortKey(uint32_t pass, uint32_t pipeline,
+                              uint32_t descriptorSet, float depth,
+                              bool backToFront = false);
+
+  void clear();
+
+  void push(const DrawPacket &packet);
+
+  void sort();
+
+  // records the packets of `pass`, binding from scratch
+  void flush(VkCommandBuffer commandBuffer, uint32_t pass = 0);
+
+  inline size_t size() const { return packets.size(); }
+
+  // bind and draw counts of the flushes since the last sort()
+  inline const Stats &getStats() const { return stats; }
+
+private:
+  std::vector<DrawPacket> packets;
+  // keys and packet indices in sorted order, plus scratch space reused by
+  // every sort so a frame does not allocate once the queue has warmed up
+  std::vector<uint64_t> keys, keysScratch;
+  std::vector<uint32_t> indices, indicesScratch;
+  Stats stats;
+};
+
+#endif // MYVK_RENDER_QUEUE_H
@@ -0,0 +1,36 @@
+#ifndef MYVK_RESOLUTION_SCALER_H
+#define MYVK_RESOLUTION_SCALER_H
+
+#include <cstdint>
+
+// Picks the fraction of the output resolution to render at so the GPU frame
+// time tracks a target. Frame times are averaged over a window of frames and
+// the scale is only moved at the end of a window, by at most MAX_STEP and in
+// multiples of SCALE_STEP, so it settles instead of chasing noise.
+class ResolutionScaler {
+public:
+  ResolutionScaler(double targetMilliseconds, float minScale, float maxScale)
+      : target(targetMilliseconds), minScale(minScale), maxScale(maxScale),
+        current(maxScale) {}
+
+  // feeds one GPU frame time, returns true when the scale changed
+  bool update(double gpuMilliseconds);
+
+  inline float scale() const { return current; }
+
+private:
+  static const uint32_t WINDOW = 8;
+  // frame times within this fraction of the target leave the scale alone
+  static constexpr double DEADBAND = 0.1;
+  static constexpr float MAX_STEP = 0.1f;
+  static constexpr float SCALE_STEP = 1.0f / 32.0f;
+
+  double target;
+  float minScale;
+  float maxScale;
+  float current;
+  double sum = 0.0;
+  uint32_t frames = 0;
+};
+
+#endif // MYVK_RESOLUTION_SCALER_H
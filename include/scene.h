@@ -0,0 +1,98 @@
+#ifndef MYVK_SCENE_H
+#define MYVK_SCENE_H
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// World transform of a visible entity as the vertex shader reads it: the top
+// three rows of the affine matrix (per-instance attributes at 48 bytes).
+struct SceneInstance {
+  glm::vec4 rows[3];
+};
+
+// Structure-of-arrays entity store. Every attribute lives in its own array
+// indexed by EntityId, so the per-frame passes (transform update, culling,
+// instance output) stream through exactly the data they need and split
+// across threads by index range.
+//
+// A parent must be created before its children. Transforms are updated one
+// hierarchy depth at a time, each depth in parallel.
+class Scene {
+public:
+  typedef uint32_t EntityId;
+  static const EntityId NO_PARENT = ~0U;
+
+  // `bounds` is the bounding sphere (xyz center, w radius) in local space
+  EntityId createEntity(EntityId parent, const glm::vec3 &position,
+                        const glm::quat &rotation, const glm::vec3 &scale,
+                        const glm::vec4 &bounds);
+
+  inline void setPosition(EntityId id, const glm::vec3 &position) {
+    positions[id] = position;
+  }
+  inline void setRotation(EntityId id, const glm::quat &rotation) {
+    rotations[id] = rotation;
+  }
+  inline void setScale(EntityId id, const glm::vec3 &scale) {
+    scales[id] = scale;
+  }
+
+  inline uint32_t size() const {
+    return static_cast<uint32_t>(parents.size());
+  }
+  inline const glm::mat4 &worldMatrix(EntityId id) const {
+    return worldMatrices[id];
+  }
+  inline glm::vec4 worldBounds(EntityId id) const {
+    return glm::vec4(boundsX[id], boundsY[id], boundsZ[id], boundsRadius[id]);
+  }
+
+  // recomputes world matrices and world bounding spheres
+  void updateTransforms();
+
+  // Tests every entity's world bounding sphere against `planes` (inside when
+  // dot(xyz, p) + w >= 0) and writes the visible ones to `instances`, grouped
+  // by the bucket in [0, bucketCount) that `classify` picks for them (e.g. a
+  // LOD). At most `capacity` instances are written; `bucketCounts` receives
+  // the number per bucket. Returns the number written.
+  uint32_t
+  gatherVisible(const glm::vec4 planes[6], uint32_t bucketCount,
+                const std::function<uint32_t(const glm::vec4 &)> &classify,
+                SceneInstance *instances, uint32_t capacity,
+                uint32_t *bucketCounts) const;
+
+private:
+  // entities per parallel work item, a multiple of the SIMD width
+  static const uint32_t CHUNK_SIZE = 4096;
+
+  std::vector<glm::vec3> positions;
+  std::vector<glm::quat> rotations;
+  std::vector<glm::vec3> scales;
+  std::vector<glm::vec4> localBounds;
+  std::vector<EntityId> parents;
+
+  std::vector<glm::mat4> worldMatrices;
+  // world bounding spheres, one array per component for the SIMD culling;
+  // padded to a multiple of 8 with spheres that are never visible
+  std::vector<float> boundsX;
+  std::vector<float> boundsY;
+  std::vector<float> boundsZ;
+  std::vector<float> boundsRadius;
+
+  // entities of each hierarchy depth, in creation order
+  std::vector<std::vector<EntityId>> levels;
+  std::vector<uint32_t> depths;
+
+  // writes the visibility of [begin, end) to `mask`, one bit per entity
+  // starting at bit 0 of mask[0]; begin is a multiple of 8
+  void cullRange(const glm::vec4 planes[6], uint32_t begin, uint32_t end,
+                 uint64_t *mask) const;
+};
+
+#endif // MYVK_SCENE_H
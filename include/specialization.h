@@ -0,0 +1,40 @@
+#ifndef MYVK_SPECIALIZATION_H
+#define MYVK_SPECIALIZATION_H
+
+#include <cstring>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Values for the constant_id constants of a shader stage, baked in when the
+// pipeline is created so the driver compiler can fold them and drop dead
+// branches. The VkSpecializationInfo returned by info() points into this
+// object and is valid until the next set().
+class SpecializationConstants {
+public:
+  // T must match the GLSL type: uint32_t, int32_t, float or VkBool32
+  template <typename T> void set(uint32_t constantId, T value) {
+    VkSpecializationMapEntry entry = {};
+    entry.constantID = constantId;
+    entry.offset = static_cast<uint32_t>(data.size());
+    entry.size = sizeof(T);
+    entries.push_back(entry);
+    data.resize(data.size() + sizeof(T));
+    std::memcpy(&data[entry.offset], &value, sizeof(T));
+  }
+
+  const VkSpecializationInfo *info() {
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(entries.size());
+    specializationInfo.pMapEntries = entries.data();
+    specializationInfo.dataSize = data.size();
+    specializationInfo.pData = data.data();
+    return &specializationInfo;
+  }
+
+private:
+  std::vector<VkSpecializationMapEntry> entries;
+  std::vector<unsigned char> data;
+  VkSpecializationInfo specializationInfo = {};
+};
+
+#endif // MYVK_SPECIALIZATION_H
@@ -0,0 +1,54 @@
+#ifndef MYVK_STAGING_RING_H
+#define MYVK_STAGING_RING_H
+
+#include "vk_handle.h"
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+
+// A persistently mapped, host coherent buffer used as a ring for uploads.
+// Space handed out by allocate() is tagged with a retire value (the frame
+// number of the submission that reads it) and is reused once collect() is
+// called with a value at least that large.
+class StagingRing {
+public:
+  struct Allocation {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *data;
+  };
+
+  void create(VkPhysicalDevice physicalDevice, VkDevice device,
+              VkDeviceSize size);
+
+  void destroy();
+
+  // returns false if the ring has no room until more space is collected
+  bool allocate(VkDeviceSize size, VkDeviceSize alignment, uint64_t retireValue,
+                Allocation &allocation);
+
+  void collect(uint64_t completedValue);
+
+  inline VkDeviceSize capacity() const { return size; }
+
+private:
+  struct Region {
+    uint64_t retireValue;
+    // bytes consumed, including any padding and the skipped tail on wrap
+    VkDeviceSize bytes;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  UniqueBuffer buffer;
+  UniqueDeviceMemory memory;
+  char *mapped = nullptr;
+
+  VkDeviceSize size = 0;
+  VkDeviceSize head = 0;
+  VkDeviceSize tail = 0;
+  VkDeviceSize used = 0;
+  std::deque<Region> regions;
+};
+
+#endif // MYVK_STAGING_RING_H
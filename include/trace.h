@@ -0,0 +1,67 @@
+#ifndef MYVK_TRACE_H
+#define MYVK_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// CPU zones and GPU ranges written into one Chrome trace-event JSON file,
+// viewable in chrome://tracing or Perfetto. Every thread records into its own
+// fixed-size ring without locking; traceFlush() drains the rings into the
+// file. Events that arrive while a ring is full are dropped and counted.
+
+// starts tracing into `path`; until then zones cost one relaxed load
+void traceStart(const std::string &path);
+
+// drains every ring into the file, may be called from any thread
+void traceFlush();
+
+// flushes and closes the file
+void traceStop();
+
+bool traceEnabled();
+
+// nanoseconds on the clock events are stamped with, std::chrono::steady_clock
+// (CLOCK_MONOTONIC on Linux)
+uint64_t traceNow();
+
+// names the calling thread's track
+void traceThreadName(const std::string &name);
+
+// returns a copy of `name` that lives as long as the process, for names that
+// are not string literals
+const char *traceIntern(const std::string &name);
+
+// a complete event on the calling thread's track; `name` must stay valid
+// until the event is flushed
+void traceEvent(const char *name, uint64_t begin, uint64_t end);
+
+// a complete event on the GPU track, times already on the traceNow() clock;
+// only one thread may record GPU events
+void traceGpuEvent(const char *name, uint64_t begin, uint64_t end);
+
+class TraceScope {
+public:
+  explicit TraceScope(const char *name)
+      : name(name), begin(traceEnabled() ? traceNow() : 0) {}
+
+  ~TraceScope() {
+    if (begin != 0) {
+      traceEvent(name, begin, traceNow());
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  const char *name;
+  uint64_t begin;
+};
+
+#define MYVK_TRACE_CONCAT_(a, b) a##b
+#define MYVK_TRACE_CONCAT(a, b) MYVK_TRACE_CONCAT_(a, b)
+// records the enclosing block as a zone named `name`, a string literal
+#define TRACE_SCOPE(name)                                                      \
+  TraceScope MYVK_TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif // MYVK_TRACE_H
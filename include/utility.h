@@ -5,6 +5,7 @@
 #ifndef MYVK_UTILITY_H
 #define MYVK_UTILITY_H
 
+#include <string>
 #include <vector>
 
 std::vector<char> readFile(const std::string& filename);
@@ -0,0 +1,99 @@
+#ifndef MYVK_VK_HANDLE_H
+#define MYVK_VK_HANDLE_H
+
+#include "deletion_queue.h"
+#include "host_allocator.h"
+#include "memory_budget.h"
+
+#include <vulkan/vulkan.h>
+
+// Owning wrapper for a handle created from a VkDevice. The handle is destroyed
+// with the matching vkDestroy* call on reset() or when the wrapper goes out of
+// scope, or handed to a DeletionQueue with retire() so it is destroyed only
+// after the frames that used it have finished on the GPU.
+template <typename T,
+          void(VKAPI_PTR *Destroy)(VkDevice, T, const VkAllocationCallbacks *)>
+class DeviceHandle {
+public:
+  DeviceHandle() = default;
+  DeviceHandle(VkDevice device, T handle) : device(device), handle(handle) {}
+
+  DeviceHandle(const DeviceHandle &) = delete;
+  DeviceHandle &operator=(const DeviceHandle &) = delete;
+
+  DeviceHandle(DeviceHandle &&other) noexcept
+      : device(other.device), handle(other.release()) {}
+
+  DeviceHandle &operator=(DeviceHandle &&other) noexcept {
+    if (this != &other) {
+      reset();
+      device = other.device;
+      handle = other.release();
+    }
+    return *this;
+  }
+
+  ~DeviceHandle() { reset(); }
+
+  // destroys the current handle and returns the slot for a vkCreate* call
+  T *replace(VkDevice dev) {
+    reset();
+    device = dev;
+    return &handle;
+  }
+
+  inline T get() const { return handle; }
+  inline operator T() const { return handle; }
+  inline explicit operator bool() const { return handle != VK_NULL_HANDLE; }
+
+  T release() {
+    T h = handle;
+    handle = VK_NULL_HANDLE;
+    return h;
+  }
+
+  void reset() {
+    if (handle != VK_NULL_HANDLE) {
+      Destroy(device, handle, hostAllocator());
+      handle = VK_NULL_HANDLE;
+    }
+  }
+
+  // destroys the handle once `retireValue` has been collected by the queue
+  void retire(DeletionQueue &queue, uint64_t retireValue) {
+    if (handle == VK_NULL_HANDLE) {
+      return;
+    }
+    VkDevice dev = device;
+    T h = release();
+    queue.push(retireValue, [dev, h]() { Destroy(dev, h, hostAllocator()); });
+  }
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  T handle = VK_NULL_HANDLE;
+};
+
+using UniqueSwapchain = DeviceHandle<VkSwapchainKHR, vkDestroySwapchainKHR>;
+using UniqueImageView = DeviceHandle<VkImageView, vkDestroyImageView>;
+using UniqueImage = DeviceHandle<VkImage, vkDestroyImage>;
+using UniqueBuffer = DeviceHandle<VkBuffer, vkDestroyBuffer>;
+// freed through freeDeviceMemory so the memory budget sees it go
+using UniqueDeviceMemory = DeviceHandle<VkDeviceMemory, freeDeviceMemory>;
+using UniqueRenderPass = DeviceHandle<VkRenderPass, vkDestroyRenderPass>;
+using UniquePipelineLayout =
+    DeviceHandle<VkPipelineLayout, vkDestroyPipelineLayout>;
+using UniquePipeline = DeviceHandle<VkPipeline, vkDestroyPipeline>;
+using UniqueFramebuffer = DeviceHandle<VkFramebuffer, vkDestroyFramebuffer>;
+using UniqueCommandPool = DeviceHandle<VkCommandPool, vkDestroyCommandPool>;
+using UniqueSemaphore = DeviceHandle<VkSemaphore, vkDestroySemaphore>;
+using UniqueFence = DeviceHandle<VkFence, vkDestroyFence>;
+using UniqueShaderModule = DeviceHandle<VkShaderModule, vkDestroyShaderModule>;
+using UniqueDescriptorSetLayout =
+    DeviceHandle<VkDescriptorSetLayout, vkDestroyDescriptorSetLayout>;
+using UniqueDescriptorPool =
+    DeviceHandle<VkDescriptorPool, vkDestroyDescriptorPool>;
+using UniqueQueryPool = DeviceHandle<VkQueryPool, vkDestroyQueryPool>;
+using UniqueSampler = DeviceHandle<VkSampler, vkDestroySampler>;
+
+#endif // MYVK_VK_HANDLE_H
@@ -0,0 +1,62 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 2) uniform Frame {
+    mat4 viewProj;
+    vec4 frustum[6];
+    vec4 cameraPosition;
+    vec4 boundsMin;
+    vec4 boundsExtent;
+    // per LOD: first meshlet, meshlet count, first instance, instance count
+    uvec4 lods[MESH_MAX_LODS];
+    uint lodCount;
+    uint drawCount;
+} frame;
+
+// quantized positions are relative to the mesh bounds
+layout(location = 0) in vec4 inPosition;
+#ifndef LOD_COLORS
+layout(location = 1) in vec4 inNormal;
+#endif
+layout(location = 2) in vec2 inUv;
+// world transform, top three rows
+layout(location = 3) in vec4 instanceRow0;
+layout(location = 4) in vec4 instanceRow1;
+layout(location = 5) in vec4 instanceRow2;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) out vec3 fragColor;
+
+// headlight shading on top of this much ambient light
+layout(constant_id = 0) const float AMBIENT = 0.1;
+
+void main() {
+    vec4 local = vec4(
+        frame.boundsMin.xyz + inPosition.xyz * frame.boundsExtent.xyz, 1.0);
+    vec3 position = vec3(dot(instanceRow0, local), dot(instanceRow1, local),
+                         dot(instanceRow2, local));
+    gl_Position = frame.viewProj * vec4(position, 1.0);
+
+#ifdef LOD_COLORS
+    // instances are grouped by LOD, see meshlet_cull.comp
+    const vec3 colors[4] = vec3[](vec3(0.2, 0.8, 0.2), vec3(0.2, 0.4, 0.9),
+                                  vec3(0.9, 0.8, 0.2), vec3(0.9, 0.3, 0.2));
+    uint lod = 0;
+    while (lod + 1 < frame.lodCount &&
+           uint(gl_InstanceIndex) >= frame.lods[lod + 1].z) {
+        ++lod;
+    }
+    fragColor = colors[lod % 4];
+#else
+    // headlight shading, instances are scaled uniformly
+    vec3 normal = normalize(vec3(dot(instanceRow0.xyz, inNormal.xyz),
+                                 dot(instanceRow1.xyz, inNormal.xyz),
+                                 dot(instanceRow2.xyz, inNormal.xyz)));
+    vec3 toCamera = normalize(frame.cameraPosition.xyz - position);
+    fragColor = vec3(AMBIENT) +
+                vec3(1.0 - AMBIENT) * max(dot(normal, toCamera), 0.0);
+#endif
+}
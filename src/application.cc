@@ -1,15 +1,49 @@
 #include "application.h"
+#include "device_selector.h"
 #include "logging.h"
+#include "trace.h"
 #include "utility.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/vec4.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
 #include <cstring>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// uniform block `Frame` of shaders/mesh.vert and shaders/meshlet_cull.comp
+struct MeshletFrame {
+  glm::mat4 viewProj;
+  // left, right, bottom, top, near, far; inside when dot(xyz, p) + w >= 0
+  glm::vec4 frustum[6];
+  glm::vec4 cameraPosition;
+  glm::vec4 boundsMin;
+  glm::vec4 boundsExtent;
+  // first meshlet, meshlet count, first instance, instance count
+  uint32_t lods[MESH_MAX_LODS][4];
+  uint32_t lodCount;
+  uint32_t drawCount;
+  uint32_t padding[2];
+  // the matrix and render extent (zw) the Hi-Z pyramid was built with, xy
+  // is the render extent of this frame
+  glm::mat4 previousViewProj;
+  glm::vec4 hizExtent;
+};
+
+} // namespace
 
 const uint32_t Application::QueueFamilyIndices::GRAPHICS = 0B01;
 const uint32_t Application::QueueFamilyIndices::PRESENT = 0B10;
@@ -17,34 +51,132 @@ const uint32_t Application::QueueFamilyIndices::PRESENT = 0B10;
 const char *Application::DEVICE_EXTENSIONS[DEVICE_EXTENSIONS_COUNT] = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME, "VK_KHR_portability_subset"};
 
+Application::Application(std::string meshPath)
+    : meshPath(std::move(meshPath)) {}
+
 void Application::run() {
+  const char *tracePath = std::getenv("MYVK_TRACE");
+  if (tracePath != nullptr) {
+    traceStart(tracePath);
+    traceThreadName("main");
+  }
   initWindow();
   initVulkan();
   mainLoop();
   cleanUp();
 }
 
+void Application::runBatch(uint32_t jobCount, VkDeviceSize jobBytes) {
+  const char *tracePath = std::getenv("MYVK_TRACE");
+  if (tracePath != nullptr) {
+    traceStart(tracePath);
+    traceThreadName("main");
+  }
+  headless = true;
+  createInstance();
+#ifndef NDEBUG
+  setUpDebugCallback();
+#endif
+  QueueFamilyIndices indices;
+  selectPhysicalDevices(indices);
+  createLogicalDevice(indices);
+  if (device == VK_NULL_HANDLE) {
+    throw std::runtime_error("No device for the batch.");
+  }
+  LOG(INFO) << "Batch queue families: compute " << computeQueueFamily
+            << ", transfer " << transferQueueFamily;
+
+  // every job filters the same input into the same output, which is enough
+  // to measure the throughput
+  if (jobBytes / sizeof(float) > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("Batch job size exceeds 2^32 floats.");
+  }
+  const uint32_t valueCount = static_cast<uint32_t>(
+      std::max<VkDeviceSize>(jobBytes / sizeof(float), 3));
+  std::vector<float> input(valueCount);
+  std::vector<float> output(valueCount);
+  for (uint32_t i = 0; i < valueCount; ++i) {
+    input[i] = static_cast<float>(i % 251);
+  }
+  ComputeBatch::Job job = {};
+  job.shader = "batch_filter.comp.spv";
+  job.bindings = {{valueCount * sizeof(float), input.data(), nullptr},
+                  {valueCount * sizeof(float), nullptr, output.data()}};
+  // the shader strides over the array, so the group count stays within
+  // the 65535 every device supports
+  job.groupCount[0] = std::min((valueCount + 63) / 64, 65535U);
+  job.groupCount[1] = 1;
+  job.groupCount[2] = 1;
+
+  ComputeBatch batch;
+  batch.create(physicalDevice, device, computeQueueFamily,
+               transferQueueFamily);
+  ComputeBatch::Stats stats =
+      batch.run(std::vector<ComputeBatch::Job>(jobCount, job));
+  batch.destroy();
+
+  // spot check against the same filter on the CPU
+  bool correct = stats.jobs == jobCount;
+  for (uint32_t i = 1; correct && jobCount > 0 && i + 1 < valueCount;
+       i += valueCount / 16 + 1) {
+    float expected = (input[i - 1] + input[i] + input[i + 1]) / 3.0f;
+    if (std::fabs(output[i] - expected) > 1e-3f) {
+      LOG(ERROR) << "Batch output " << i << " is " << output[i]
+                 << ", expected " << expected;
+      correct = false;
+    }
+  }
+
+  vkDestroyDevice(device, hostAllocator());
+#ifndef NDEBUG
+  DestroyDebugReportCallbackEXT(instance, callback, hostAllocator());
+#endif
+  vkDestroyInstance(instance, hostAllocator());
+  logHostAllocatorStats();
+  traceStop();
+  if (!correct) {
+    throw std::runtime_error(stats.jobs == jobCount
+                                 ? "Batch output is wrong."
+                                 : "Batch jobs failed.");
+  }
+}
+
 void Application::initVulkan() {
+  TRACE_SCOPE("initVulkan");
   createInstance();
 #ifndef NDEBUG
   setUpDebugCallback();
 #endif
-  createSurface();
+  createSurfaces();
   QueueFamilyIndices indices;
-  SwapChainSupportDetails swapChainSupportDetails;
-  selectPhysicalDevices(indices, swapChainSupportDetails);
+  selectPhysicalDevices(indices);
   createLogicalDevice(indices);
-  createSwapChain(swapChainSupportDetails, indices);
-  createImageViews();
+  createFrameMetrics();
+  createSwapChains(indices);
+  chooseAttachmentFormats();
+  createCommandPool(indices);
+  stagingRing.create(physicalDevice, device, STAGING_RING_SIZE);
+  if (!meshPath.empty()) {
+    loadMesh(meshPath);
+  }
+  occlusionCulling = occlusionCulling && !mesh.lods.empty();
   createRenderPass();
+  createDescriptorSetLayout();
   createGraphicsPipeline();
+  createCullPipeline();
+  createScene();
+  createMeshletResources();
+  for (Window &window : windows) {
+    createRenderGraph(window);
+  }
+  // the framebuffers hold the attachments the render graphs allocated
   createFramebuffers();
-  createCommandPool(indices);
   createCommandBuffers();
-  createSemaphores();
+  createSyncObjects();
 }
 
 void Application::createInstance() {
+  TRACE_SCOPE("createInstance");
   VkApplicationInfo appInfo = {};
   appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
   appInfo.pNext = nullptr;
@@ -52,34 +184,46 @@ void Application::createInstance() {
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "NO Engine";
   appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  // 1.3 where the loader has it, for dynamic rendering; a 1.0 loader
+  // rejects any higher version
+  auto enumerateInstanceVersion =
+      (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(
+          nullptr, "vkEnumerateInstanceVersion");
+  instanceApiVersion = VK_API_VERSION_1_0;
+  if (enumerateInstanceVersion != nullptr &&
+      enumerateInstanceVersion(&instanceApiVersion) == VK_SUCCESS) {
+    instanceApiVersion = std::min(instanceApiVersion, VK_API_VERSION_1_3);
+  }
+  appInfo.apiVersion = instanceApiVersion;
 
   VkInstanceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
   createInfo.pApplicationInfo = &appInfo;
 
-  if (glfwVulkanSupported() != GLFW_TRUE) {
-    LOG(ERROR) << "No Vulkan support!";
-  }
-
+  // headless, glfw is never initialized and no surface is created
   uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions =
-      glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-  if (glfwExtensions == nullptr) {
-    LOG(ERROR) << "Fail to get vulkan extensions.";
+  const char **glfwExtensions = nullptr;
+  if (!headless) {
+    if (glfwVulkanSupported() != GLFW_TRUE) {
+      LOG(ERROR) << "No Vulkan support!";
+    }
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    if (glfwExtensions == nullptr) {
+      LOG(ERROR) << "Fail to get vulkan extensions.";
+    }
   }
 
 #ifndef NDEBUG
   uint32_t extensionCount = glfwExtensionCount + 2;
   const char **extensions = new const char *[extensionCount];
-  std::memcpy(extensions, glfwExtensions, sizeof(char *) * glfwExtensionCount);
+  std::copy(glfwExtensions, glfwExtensions + glfwExtensionCount, extensions);
   extensions[extensionCount - 2] = VK_EXT_DEBUG_REPORT_EXTENSION_NAME;
   extensions[extensionCount - 1] =
       VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
 #else
   uint32_t extensionCount = glfwExtensionCount + 1;
   const char **extensions = new const char *[extensionCount];
-  std::memcpy(extensions, glfwExtensions, sizeof(char *) * glfwExtensionCount);
+  std::copy(glfwExtensions, glfwExtensions + glfwExtensionCount, extensions);
   extensions[extensionCount - 1] =
       VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
 #endif
@@ -87,7 +231,7 @@ void Application::createInstance() {
   createInfo.ppEnabledExtensionNames = extensions;
   createInfo.enabledLayerCount = 0;
 
-  VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+  VkResult result = vkCreateInstance(&createInfo, hostAllocator(), &instance);
   if (result != VK_SUCCESS) {
     LOG(ERROR) << "Fail to create Vulkan instance";
   }
@@ -101,8 +245,8 @@ void Application::setUpDebugCallback() {
       VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
   createInfo.pfnCallback = Application::debugCallback;
 
-  if (CreateDebugReportCallbackEXT(instance, &createInfo, nullptr, &callback) !=
-      VK_SUCCESS) {
+  if (CreateDebugReportCallbackEXT(instance, &createInfo, hostAllocator(),
+                                   &callback) != VK_SUCCESS) {
     LOG(ERROR) << "failed to set up debug callback!";
   }
 }
@@ -145,29 +289,63 @@ void Application::initWindow() {
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
   glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
-  window = glfwCreateWindow(static_cast<int>(WIDTH), static_cast<int>(HEIGHT),
-                            "Hello", nullptr, nullptr);
+  // MYVK_WINDOWS opens several windows, all rendered by one device
+  uint32_t windowCount = 1;
+  const char *windowsEnv = std::getenv("MYVK_WINDOWS");
+  if (windowsEnv != nullptr) {
+    windowCount = static_cast<uint32_t>(
+        std::max(1L, std::min(std::strtol(windowsEnv, nullptr, 10),
+                              static_cast<long>(MAX_WINDOWS))));
+  }
+
+  windows = std::vector<Window>(windowCount);
+  for (uint32_t i = 0; i < windowCount; ++i) {
+    std::string title = "Hello";
+    if (windowCount > 1) {
+      title += " " + std::to_string(i);
+    }
+    windows[i].handle =
+        glfwCreateWindow(static_cast<int>(WIDTH), static_cast<int>(HEIGHT),
+                         title.c_str(), nullptr, nullptr);
+    // the windows split the GPU time target
+    windows[i].resolutionScaler = ResolutionScaler(
+        TARGET_GPU_MILLISECONDS / windowCount, MIN_RENDER_SCALE, 1.0f);
+  }
 }
 
-void Application::selectPhysicalDevices(
-    QueueFamilyIndices &indices, SwapChainSupportDetails &swapChainSupport) {
+void Application::selectPhysicalDevices(QueueFamilyIndices &indices) {
   physicalDevice = VK_NULL_HANDLE;
   uint32_t deviceCount = 0;
   vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
   if (deviceCount == 0) {
     LOG(ERROR) << "No available physical devices found.";
   }
-  auto *devices = new VkPhysicalDevice[deviceCount];
-  vkEnumeratePhysicalDevices(instance, &deviceCount, devices);
-
-  // find first suitable physical device
-  for (auto *d = devices; d != devices + deviceCount; ++d) {
-    if (isDeviceSuitable(*d, indices, swapChainSupport)) {
-      physicalDevice = *d;
-      break;
+  std::vector<VkPhysicalDevice> devices(deviceCount);
+  vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+  // every suitable device is a candidate, each with its own queue families
+  std::vector<DeviceSelector::Candidate> candidates;
+  std::vector<QueueFamilyIndices> candidateIndices;
+  for (VkPhysicalDevice d : devices) {
+    QueueFamilyIndices deviceIndices;
+    if (isDeviceSuitable(d, deviceIndices)) {
+      candidates.push_back(
+          {d, deviceIndices.getIndex(QueueFamilyIndices::GRAPHICS)});
+      candidateIndices.push_back(deviceIndices);
     }
   }
-  delete[] devices;
+
+  std::string cachePath = DEVICE_CACHE_PATH;
+  if (std::getenv("MYVK_DEVICE_CACHE") != nullptr) {
+    cachePath = std::getenv("MYVK_DEVICE_CACHE");
+  }
+  DeviceSelector selector(instance, cachePath);
+  int chosen = selector.select(
+      candidates, std::getenv("MYVK_NO_DEVICE_BENCHMARK") == nullptr);
+  if (chosen >= 0) {
+    physicalDevice = candidates[chosen].device;
+    indices = candidateIndices[chosen];
+  }
 
   if (physicalDevice == VK_NULL_HANDLE) {
     LOG(ERROR) << "Failed to find a suitable GPU.";
@@ -175,8 +353,7 @@ void Application::selectPhysicalDevices(
 }
 
 bool Application::isDeviceSuitable(const VkPhysicalDevice &dev,
-                                   QueueFamilyIndices &indices,
-                                   SwapChainSupportDetails &swapChainSupport) {
+                                   QueueFamilyIndices &indices) {
   // check dev suitability
 #ifndef NDEBUG
   VkPhysicalDeviceProperties deviceProperties;
@@ -187,11 +364,15 @@ bool Application::isDeviceSuitable(const VkPhysicalDevice &dev,
   LOG(INFO) << "Find physical dev: " << deviceProperties.deviceID << " "
             << deviceProperties.vendorID << " " << deviceProperties.deviceName;
 #endif
-  if (checkDeviceExtensions(dev)) {
-    swapChainSupport = querySwapChainSupport(dev);
-    if (swapChainSupport.formats.empty() ||
-        swapChainSupport.presentModes.empty()) {
-      return false;
+  // headless needs no swap chain, and with no windows any family presents
+  if (headless || checkDeviceExtensions(dev)) {
+    for (const Window &window : windows) {
+      SwapChainSupportDetails swapChainSupport =
+          querySwapChainSupport(dev, window.surface);
+      if (swapChainSupport.formats.empty() ||
+          swapChainSupport.presentModes.empty()) {
+        return false;
+      }
     }
     return findQueueFamilies(dev, indices);
   }
@@ -235,12 +416,20 @@ bool Application::findQueueFamilies(const VkPhysicalDevice &dev,
       indices.setIndex(QueueFamilyIndices::GRAPHICS, i);
     }
 
-    if (indices.checkFlag(QueueFamilyIndices::PRESENT)) {
-      VkBool32 presentSupport = false;
-      if (queueFamilies[i].queueCount > 0 &&
-          vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, surface,
-                                               &presentSupport) == VK_SUCCESS &&
-          presentSupport) {
+    // one queue presents all windows
+    if (indices.checkFlag(QueueFamilyIndices::PRESENT) &&
+        queueFamilies[i].queueCount > 0) {
+      bool presentSupport = true;
+      for (const Window &window : windows) {
+        VkBool32 supported = VK_FALSE;
+        if (vkGetPhysicalDeviceSurfaceSupportKHR(dev, i, window.surface,
+                                                 &supported) != VK_SUCCESS ||
+            !supported) {
+          presentSupport = false;
+          break;
+        }
+      }
+      if (presentSupport) {
         indices.setIndex(QueueFamilyIndices::PRESENT, i);
       }
     }
@@ -255,89 +444,362 @@ bool Application::findQueueFamilies(const VkPhysicalDevice &dev,
   return false;
 }
 
+bool Application::windowClosed() const {
+  for (const Window &window : windows) {
+    if (glfwWindowShouldClose(window.handle)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void Application::mainLoop() {
-  while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
-    drawFrame();
+  running = true;
+  std::thread simulation(&Application::simulationLoop, this);
+  std::thread render(&Application::renderLoop, this);
+  // closing any window ends the application
+  while (!windowClosed()) {
+    glfwWaitEvents();
+    bool traceKey = false;
+    for (const Window &window : windows) {
+      traceKey =
+          traceKey || glfwGetKey(window.handle, GLFW_KEY_F12) == GLFW_PRESS;
+    }
+    if (traceKey && !traceKeyDown) {
+      traceFlushRequested = true;
+    }
+    traceKeyDown = traceKey;
   }
+  {
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    running = false;
+  }
+  snapshotChanged.notify_all();
+  simulation.join();
+  render.join();
   vkDeviceWaitIdle(device);
 }
 
+void Application::simulationLoop() {
+  traceThreadName("simulation");
+  while (true) {
+    int target;
+    {
+      // at most one frame ahead: a published snapshot waits to be taken
+      std::unique_lock<std::mutex> lock(snapshotMutex);
+      snapshotChanged.wait(
+          lock, [this]() { return !running || publishedSnapshot < 0; });
+      if (!running) {
+        return;
+      }
+      target = renderedSnapshot == 0 ? 1 : 0;
+    }
+    updateScene(snapshots[target], static_cast<float>(glfwGetTime()));
+    {
+      std::lock_guard<std::mutex> lock(snapshotMutex);
+      publishedSnapshot = target;
+    }
+    snapshotChanged.notify_all();
+  }
+}
+
+void Application::renderLoop() {
+  traceThreadName("render");
+  while (true) {
+    int snapshot;
+    {
+      std::unique_lock<std::mutex> lock(snapshotMutex);
+      snapshotChanged.wait(
+          lock, [this]() { return !running || publishedSnapshot >= 0; });
+      if (!running) {
+        return;
+      }
+      snapshot = publishedSnapshot;
+      renderedSnapshot = snapshot;
+      publishedSnapshot = -1;
+    }
+    // the simulation moves on to the other snapshot while this one is drawn
+    snapshotChanged.notify_all();
+    drawFrame(snapshots[snapshot]);
+    if (traceEnabled() && (traceFlushRequested.exchange(false) ||
+                           frameNumber % TRACE_FLUSH_INTERVAL == 0)) {
+      TRACE_SCOPE("traceFlush");
+      traceFlush();
+    }
+  }
+}
+
 void Application::cleanUp() {
-  vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-  vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
-  vkDestroyCommandPool(device, commandPool, nullptr);
-  for (auto &swapChainFramebuffer : swapChainFramebuffers) {
-    vkDestroyFramebuffer(device, swapChainFramebuffer, nullptr);
-  }
-  vkDestroyPipeline(device, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-  vkDestroyRenderPass(device, renderPass, nullptr);
-  for (auto &swapChainImageView : swapChainImageViews) {
-    vkDestroyImageView(device, swapChainImageView, nullptr);
-  }
-  vkDestroySwapchainKHR(device, swapChain, nullptr);
-  vkDestroyDevice(device, nullptr);
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+  // the device is idle here, so everything still pending can go
+  deletionQueue.flush();
+
+  // device-level handles must be released before the device itself
+  for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    inFlightFences[i].reset();
+    renderFinishedSemaphores[i].reset();
+  }
+  commandPool.reset();
+  mainPassQueries.destroy();
+  gpuTrace.destroy();
+  stagingRing.destroy();
+  meshletFrames.clear();
+  descriptorPool.reset();
+  mesh = GpuMesh();
+  for (Window &window : windows) {
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+      window.imageAvailableSemaphores[i].reset();
+    }
+    window.sceneFramebuffer.reset();
+    window.hizFramebuffer.reset();
+    window.hiz.destroy();
+    if (window.renderGraph.lazyMemorySize() > 0) {
+      LOG(INFO) << "Lazily allocated attachments: "
+                << window.renderGraph.lazyCommitment(device) << " of "
+                << window.renderGraph.lazyMemorySize()
+                << " bytes committed";
+    }
+    window.renderGraph.reset();
+    window.framebuffers.clear();
+  }
+  cullPipeline.reset();
+  lateCullPipeline.reset();
+  graphicsPipeline.reset();
+  depthPrepassPipeline.reset();
+  pipelineLayout.reset();
+  meshletSetLayout.reset();
+  renderPass.reset();
+  depthRenderPass.reset();
+  for (Window &window : windows) {
+    window.imageViews.clear();
+    window.swapChain.reset();
+  }
+  vkDestroyDevice(device, hostAllocator());
+  for (Window &window : windows) {
+    vkDestroySurfaceKHR(instance, window.surface, hostAllocator());
+  }
 #ifndef NDEBUG
-  DestroyDebugReportCallbackEXT(instance, callback, nullptr);
+  DestroyDebugReportCallbackEXT(instance, callback, hostAllocator());
 #endif
-  vkDestroyInstance(instance, nullptr);
-  glfwDestroyWindow(window);
+  vkDestroyInstance(instance, hostAllocator());
+  for (Window &window : windows) {
+    glfwDestroyWindow(window.handle);
+  }
   glfwTerminate();
+  logHostAllocatorStats();
+  traceStop();
 }
 
 void Application::createLogicalDevice(
     const QueueFamilyIndices &queueFamilyIndices) {
-  VkDeviceQueueCreateInfo queueCreateInfos[QueueFamilyIndices::FLAGS] = {};
+  TRACE_SCOPE("createLogicalDevice");
+  graphicsQueueFamily =
+      queueFamilyIndices.getIndex(QueueFamilyIndices::GRAPHICS);
+  computeQueueFamily = graphicsQueueFamily;
+  transferQueueFamily = graphicsQueueFamily;
+  if (headless) {
+    chooseBatchQueueFamilies();
+  }
+  // one queue of every distinct family
+  const uint32_t families[] = {
+      graphicsQueueFamily,
+      queueFamilyIndices.getIndex(QueueFamilyIndices::PRESENT),
+      computeQueueFamily, transferQueueFamily};
+  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   float priority = 1.0f;
-  for (int i = 0; i < QueueFamilyIndices::FLAGS; ++i) {
-    queueCreateInfos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCreateInfos[i].queueFamilyIndex = queueFamilyIndices.getIndex(i, true);
-    queueCreateInfos[i].queueCount = 1;
-    queueCreateInfos[i].pQueuePriorities = &priority;
+  for (uint32_t family : families) {
+    if (std::any_of(queueCreateInfos.begin(), queueCreateInfos.end(),
+                    [family](const VkDeviceQueueCreateInfo &info) {
+                      return info.queueFamilyIndex == family;
+                    })) {
+      continue;
+    }
+    VkDeviceQueueCreateInfo queueCreateInfo = {};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = family;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &priority;
+    queueCreateInfos.push_back(queueCreateInfo);
   }
 
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
   VkPhysicalDeviceFeatures deviceFeatures = {};
+  // lets all meshlet draws go out in a single indirect call
+  if (supportedFeatures.multiDrawIndirect == VK_TRUE) {
+    deviceFeatures.multiDrawIndirect = VK_TRUE;
+    maxDrawIndirectCount = properties.limits.maxDrawIndirectCount;
+  }
+  // lets each LOD's draws start at its range of the instance buffer
+  if (supportedFeatures.drawIndirectFirstInstance == VK_TRUE) {
+    deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    drawIndirectFirstInstance = true;
+  }
+  // per pass vertex and fragment counts for the frame metrics
+  if (supportedFeatures.pipelineStatisticsQuery == VK_TRUE) {
+    deviceFeatures.pipelineStatisticsQuery = VK_TRUE;
+    pipelineStatisticsQuery = true;
+  }
+  if (supportedFeatures.occlusionQueryPrecise == VK_TRUE) {
+    deviceFeatures.occlusionQueryPrecise = VK_TRUE;
+    occlusionQueryPrecise = true;
+  }
+  // the Hi-Z pyramid is an rg32f storage image
+  if (std::getenv("MYVK_NO_OCCLUSION") == nullptr && !meshPath.empty() &&
+      supportedFeatures.shaderStorageImageExtendedFormats == VK_TRUE &&
+      HiZPyramid::supported(physicalDevice)) {
+    deviceFeatures.shaderStorageImageExtendedFormats = VK_TRUE;
+    occlusionCulling = true;
+  }
+
+  std::vector<const char *> extensions;
+  if (!headless) {
+    extensions.assign(DEVICE_EXTENSIONS,
+                      DEVICE_EXTENSIONS + DEVICE_EXTENSIONS_COUNT);
+  }
+  // per-heap budget and usage, including other processes' pressure
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr,
+                                       &extensionCount,
+                                       availableExtensions.data());
+  bool memoryBudgetExtension = false;
+  for (const auto &extension : availableExtensions) {
+    // must be enabled where present, which checkDeviceExtensions made sure
+    // of unless headless
+    if (headless && std::strcmp(extension.extensionName,
+                                "VK_KHR_portability_subset") == 0) {
+      extensions.push_back("VK_KHR_portability_subset");
+    }
+    if (std::strcmp(extension.extensionName,
+                    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+      extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+      memoryBudgetExtension = true;
+    }
+    // lines GPU timestamps up with CPU zones in the trace
+    if (std::strcmp(extension.extensionName,
+                    VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME) == 0) {
+      extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+      calibratedTimestamps = true;
+    }
+  }
+
+  VkPhysicalDeviceVulkan13Features features13 = {};
+  features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  auto getFeatures2 =
+      (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+          instance, "vkGetPhysicalDeviceFeatures2KHR");
+  if (std::getenv("MYVK_RENDER_PASS") == nullptr &&
+      instanceApiVersion >= VK_API_VERSION_1_3 &&
+      properties.apiVersion >= VK_API_VERSION_1_3 && getFeatures2 != nullptr) {
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &features13;
+    getFeatures2(physicalDevice, &features2);
+    dynamicRendering = features13.dynamicRendering == VK_TRUE &&
+                       features13.synchronization2 == VK_TRUE;
+  }
+  // enable only the two, whatever else the device reported
+  features13 = {};
+  features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  features13.dynamicRendering = VK_TRUE;
+  features13.synchronization2 = VK_TRUE;
 
   VkDeviceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  if (queueFamilyIndices.getIndex(QueueFamilyIndices::GRAPHICS) !=
-      queueFamilyIndices.getIndex(QueueFamilyIndices::PRESENT)) {
-    createInfo.pQueueCreateInfos = queueCreateInfos;
-    createInfo.queueCreateInfoCount = QueueFamilyIndices::FLAGS;
-  } else {
-    createInfo.pQueueCreateInfos = queueCreateInfos;
-    createInfo.queueCreateInfoCount = 1;
+  if (dynamicRendering) {
+    createInfo.pNext = &features13;
   }
+  createInfo.pQueueCreateInfos = queueCreateInfos.data();
+  createInfo.queueCreateInfoCount =
+      static_cast<uint32_t>(queueCreateInfos.size());
 
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount = DEVICE_EXTENSIONS_COUNT;
-  createInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS;
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
   createInfo.enabledLayerCount = 0;
 
-  if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) !=
+  if (vkCreateDevice(physicalDevice, &createInfo, hostAllocator(), &device) !=
       VK_SUCCESS) {
     LOG(ERROR) << "Fail to create logical device!";
   }
+  memoryBudget.create(instance, physicalDevice, memoryBudgetExtension);
+
+  if (dynamicRendering) {
+    cmdBeginRendering = (PFN_vkCmdBeginRendering)vkGetDeviceProcAddr(
+        device, "vkCmdBeginRendering");
+    cmdEndRendering =
+        (PFN_vkCmdEndRendering)vkGetDeviceProcAddr(device, "vkCmdEndRendering");
+    cmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2)vkGetDeviceProcAddr(
+        device, "vkCmdPipelineBarrier2");
+    dynamicRendering = cmdBeginRendering != nullptr &&
+                       cmdEndRendering != nullptr &&
+                       cmdPipelineBarrier2 != nullptr;
+    if (!dynamicRendering) {
+      cmdPipelineBarrier2 = nullptr;
+    }
+  }
+  LOG(INFO) << (dynamicRendering ? "Dynamic rendering" : "Render pass")
+            << " path";
 
-  vkGetDeviceQueue(device,
-                   queueFamilyIndices.getIndex(QueueFamilyIndices::GRAPHICS), 0,
-                   &graphicsQueue);
+  vkGetDeviceQueue(device, graphicsQueueFamily, 0, &graphicsQueue);
   vkGetDeviceQueue(device,
                    queueFamilyIndices.getIndex(QueueFamilyIndices::PRESENT), 0,
                    &presentQueue);
 }
 
-void Application::createSurface() {
-  if (glfwCreateWindowSurface(instance, window, nullptr, &surface) !=
-      VK_SUCCESS) {
-    LOG(ERROR) << "Fail to create window surface";
+void Application::chooseBatchQueueFamilies() {
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
+  // async compute: a compute family without graphics
+  for (uint32_t i = 0; i < familyCount; ++i) {
+    if (families[i].queueCount > 0 &&
+        (families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      computeQueueFamily = i;
+      break;
+    }
+  }
+  // a DMA family, else any other than compute; graphics and compute families
+  // can always transfer
+  const VkQueueFlags transferFlags =
+      VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
+  transferQueueFamily = computeQueueFamily;
+  for (uint32_t i = 0; i < familyCount; ++i) {
+    if (families[i].queueCount == 0 ||
+        !(families[i].queueFlags & transferFlags)) {
+      continue;
+    }
+    if ((families[i].queueFlags & transferFlags) == VK_QUEUE_TRANSFER_BIT) {
+      transferQueueFamily = i;
+      break;
+    }
+    if (transferQueueFamily == computeQueueFamily && i != computeQueueFamily) {
+      transferQueueFamily = i;
+    }
+  }
+}
+
+void Application::createSurfaces() {
+  for (Window &window : windows) {
+    if (glfwCreateWindowSurface(instance, window.handle, hostAllocator(),
+                                &window.surface) != VK_SUCCESS) {
+      LOG(ERROR) << "Fail to create window surface";
+    }
   }
 }
 
 Application::SwapChainSupportDetails
-Application::querySwapChainSupport(VkPhysicalDevice const &dev) {
+Application::querySwapChainSupport(VkPhysicalDevice const &dev,
+                                   VkSurfaceKHR surface) {
   SwapChainSupportDetails details;
   vkGetPhysicalDeviceSurfaceCapabilitiesKHR(dev, surface,
                                             &details.capabilities);
@@ -362,10 +824,21 @@ Application::querySwapChainSupport(VkPhysicalDevice const &dev) {
   return details;
 }
 VkSurfaceFormatKHR Application::chooseSwapSurfaceFormat(
-    const std::vector<VkSurfaceFormatKHR> &availableFormats) {
+    const std::vector<VkSurfaceFormatKHR> &availableFormats, bool first) {
   if (availableFormats.size() == 1 &&
       availableFormats[0].format == VK_FORMAT_UNDEFINED) {
-    return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+    return {first ? VK_FORMAT_B8G8R8A8_UNORM : swapChainImageFormat,
+            VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+  }
+
+  // later windows have to take the format of the first one
+  if (!first) {
+    for (const auto &format : availableFormats) {
+      if (format.format == swapChainImageFormat) {
+        return format;
+      }
+    }
+    throw std::runtime_error("windows have no common surface format!");
   }
 
   for (const auto &format : availableFormats) {
@@ -409,11 +882,22 @@ Application::chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities) {
     return actualExtent;
   }
 }
-void Application::createSwapChain(
-    const SwapChainSupportDetails &swapChainSupport,
-    const QueueFamilyIndices &indices) {
-  VkSurfaceFormatKHR surfaceFormat =
-      chooseSwapSurfaceFormat(swapChainSupport.formats);
+void Application::createSwapChains(const QueueFamilyIndices &indices) {
+  slotCount = 0;
+  for (Window &window : windows) {
+    createSwapChain(window, indices);
+    createImageViews(window);
+    window.firstSlot = slotCount;
+    slotCount += static_cast<uint32_t>(window.images.size());
+  }
+}
+
+void Application::createSwapChain(Window &window,
+                                  const QueueFamilyIndices &indices) {
+  SwapChainSupportDetails swapChainSupport =
+      querySwapChainSupport(physicalDevice, window.surface);
+  VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(
+      swapChainSupport.formats, &window == &windows.front());
   VkPresentModeKHR presentMode =
       chooseSwapPresentMode(swapChainSupport.presentModes);
   VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
@@ -427,13 +911,19 @@ void Application::createSwapChain(
 
   VkSwapchainCreateInfoKHR createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-  createInfo.surface = surface;
+  createInfo.surface = window.surface;
   createInfo.minImageCount = imageCount;
   createInfo.imageFormat = surfaceFormat.format;
   createInfo.imageColorSpace = surfaceFormat.colorSpace;
   createInfo.imageExtent = extent;
   createInfo.imageArrayLayers = 1; // 2D
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // the scaled scene is blitted onto the swap chain image
+  if (swapChainSupport.capabilities.supportedUsageFlags &
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT) {
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
+  window.usage = createInfo.imageUsage;
 
   if (indices.getIndex(QueueFamilyIndices::GRAPHICS) !=
       indices.getIndex(QueueFamilyIndices::PRESENT)) {
@@ -452,25 +942,25 @@ void Application::createSwapChain(
   createInfo.clipped = VK_TRUE;
   createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-  if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) !=
-      VK_SUCCESS) {
+  if (vkCreateSwapchainKHR(device, &createInfo, hostAllocator(),
+                           window.swapChain.replace(device)) != VK_SUCCESS) {
     LOG(ERROR) << "Fail to create swap chain.";
   }
 
-  vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-  swapChainImages.resize(imageCount);
-  vkGetSwapchainImagesKHR(device, swapChain, &imageCount,
-                          swapChainImages.data());
+  vkGetSwapchainImagesKHR(device, window.swapChain, &imageCount, nullptr);
+  window.images.resize(imageCount);
+  vkGetSwapchainImagesKHR(device, window.swapChain, &imageCount,
+                          window.images.data());
   swapChainImageFormat = surfaceFormat.format;
-  swapChainExtent = extent;
+  window.extent = extent;
 }
 
-void Application::createImageViews() {
-  swapChainImageViews.resize(swapChainImages.size());
-  for (size_t i = 0; i < swapChainImages.size(); ++i) {
+void Application::createImageViews(Window &window) {
+  window.imageViews.resize(window.images.size());
+  for (size_t i = 0; i < window.images.size(); ++i) {
     VkImageViewCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    createInfo.image = swapChainImages[i];
+    createInfo.image = window.images[i];
     createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     createInfo.format = swapChainImageFormat;
     createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -482,15 +972,82 @@ void Application::createImageViews() {
     createInfo.subresourceRange.levelCount = 1;
     createInfo.subresourceRange.baseArrayLayer = 0;
     createInfo.subresourceRange.layerCount = 1;
-    if (vkCreateImageView(device, &createInfo, nullptr,
-                          &swapChainImageViews[i]) != VK_SUCCESS) {
+    if (vkCreateImageView(device, &createInfo, hostAllocator(),
+                          window.imageViews[i].replace(device)) !=
+        VK_SUCCESS) {
       LOG(ERROR) << "Fail to create image views.";
     }
   }
 }
+
+void Application::chooseAttachmentFormats() {
+  const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT,
+                                 VK_FORMAT_D24_UNORM_S8_UINT,
+                                 VK_FORMAT_D16_UNORM};
+  for (VkFormat format : candidates) {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format,
+                                        &formatProperties);
+    if (formatProperties.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+      depthFormat = format;
+      break;
+    }
+  }
+  if (depthFormat == VK_FORMAT_UNDEFINED) {
+    throw std::runtime_error("no supported depth format!");
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  VkSampleCountFlags sampleCounts =
+      properties.limits.framebufferColorSampleCounts &
+      properties.limits.framebufferDepthSampleCounts;
+  msaaSamples = (sampleCounts & VK_SAMPLE_COUNT_4_BIT) ? VK_SAMPLE_COUNT_4_BIT
+                                                       : VK_SAMPLE_COUNT_1_BIT;
+  LOG(INFO) << "Depth format " << depthFormat << ", " << msaaSamples
+            << "x MSAA";
+}
+
+void Application::createDescriptorSetLayout() {
+  if (mesh.lods.empty()) {
+    return;
+  }
+  // 0: meshlets, 1: indirect draws, 2: frame uniforms, 3: instances, and
+  // with occlusion culling 4: the Hi-Z pyramid
+  VkDescriptorSetLayoutBinding bindings[5] = {};
+  for (uint32_t i = 0; i < 5; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  bindings[2].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+  bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = occlusionCulling ? 5 : 4;
+  layoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, hostAllocator(),
+                                  meshletSetLayout.replace(device)) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Failed to create descriptor set layout!";
+  }
+}
+
 void Application::createGraphicsPipeline() {
-  auto vertShaderCode = readFile("vert.spv");
-  auto fragShaderCode = readFile("frag.spv");
+  TRACE_SCOPE("createGraphicsPipeline");
+  // with a mesh loaded the pipeline draws meshlets from its vertex buffer,
+  // otherwise the triangle generated in the vertex shader
+  const bool drawMesh = !mesh.lods.empty();
+  // MYVK_LOD_COLORS picks the shader variant that colors instances by LOD
+  const char *meshShader = std::getenv("MYVK_LOD_COLORS") != nullptr
+                               ? "mesh.lod_colors.vert.spv"
+                               : "mesh.vert.spv";
+  auto vertShaderCode = readFile(drawMesh ? meshShader : "shader.vert.spv");
+  auto fragShaderCode = readFile("shader.frag.spv");
   VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
   VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
 
@@ -500,6 +1057,11 @@ void Application::createGraphicsPipeline() {
   vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
   vertShaderStageInfo.module = vertShaderModule;
   vertShaderStageInfo.pName = "main";
+  SpecializationConstants vertConstants;
+  if (drawMesh) {
+    vertConstants.set(0, AMBIENT_LIGHT);
+    vertShaderStageInfo.pSpecializationInfo = vertConstants.info();
+  }
 
   VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
   fragShaderStageInfo.sType =
@@ -519,28 +1081,60 @@ void Application::createGraphicsPipeline() {
   vertexInputInfo.vertexAttributeDescriptionCount = 0;
   vertexInputInfo.pVertexAttributeDescriptions = nullptr;
 
+  VkVertexInputBindingDescription bindingDescriptions[2] = {};
+  bindingDescriptions[0].binding = 0;
+  bindingDescriptions[0].stride = sizeof(PackedVertex);
+  bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  bindingDescriptions[1].binding = 1;
+  bindingDescriptions[1].stride = sizeof(SceneInstance);
+  bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+  VkVertexInputAttributeDescription attributeDescriptions[6] = {};
+  attributeDescriptions[0].location = 0;
+  attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+  attributeDescriptions[0].offset = offsetof(PackedVertex, position);
+  attributeDescriptions[1].location = 1;
+  attributeDescriptions[1].format = VK_FORMAT_R8G8B8A8_SNORM;
+  attributeDescriptions[1].offset = offsetof(PackedVertex, normal);
+  attributeDescriptions[2].location = 2;
+  attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+  attributeDescriptions[2].offset = offsetof(PackedVertex, uv);
+  for (uint32_t row = 0; row < 3; ++row) {
+    attributeDescriptions[3 + row].location = 3 + row;
+    attributeDescriptions[3 + row].binding = 1;
+    attributeDescriptions[3 + row].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[3 + row].offset =
+        static_cast<uint32_t>(row * sizeof(glm::vec4));
+  }
+
+  if (drawMesh) {
+    vertexInputInfo.vertexBindingDescriptionCount = 2;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
+    vertexInputInfo.vertexAttributeDescriptionCount = 6;
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+  }
+
   VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
   inputAssembly.sType =
       VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
   inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
   inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-  VkViewport viewport = {};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = static_cast<float>(swapChainExtent.width);
-  viewport.height = static_cast<float>(swapChainExtent.height);
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor{.offset = {0, 0}, .extent = swapChainExtent};
-
+  // both are dynamic, so windows of any size share the pipeline
   VkPipelineViewportStateCreateInfo viewportState = {};
   viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
+  viewportState.pViewports = nullptr;
   viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
+  viewportState.pScissors = nullptr;
+
+  // the render resolution changes at run time, see recordMainPass
+  VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                    VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamicState = {};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
 
   VkPipelineRasterizationStateCreateInfo rasterizer = {};
   rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -549,7 +1143,10 @@ void Application::createGraphicsPipeline() {
   rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
   rasterizer.lineWidth = 1.0f;
   rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  // meshes are counter clockwise; their projection flips y, so they stay
+  // counter clockwise in framebuffer space
+  rasterizer.frontFace =
+      drawMesh ? VK_FRONT_FACE_COUNTER_CLOCKWISE : VK_FRONT_FACE_CLOCKWISE;
   rasterizer.depthBiasEnable = VK_FALSE;
   rasterizer.depthBiasConstantFactor = 0.0f;
   rasterizer.depthBiasClamp = 0.0f;
@@ -559,12 +1156,21 @@ void Application::createGraphicsPipeline() {
   multisampling.sType =
       VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
   multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  multisampling.rasterizationSamples = msaaSamples;
   multisampling.minSampleShading = 1.0f;          // Optional
   multisampling.pSampleMask = nullptr;            // Optional
   multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
   multisampling.alphaToOneEnable = VK_FALSE;      // Optional
 
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+  depthStencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable = VK_TRUE;
+  depthStencil.depthWriteEnable = VK_TRUE;
+  depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+  depthStencil.depthBoundsTestEnable = VK_FALSE;
+  depthStencil.stencilTestEnable = VK_FALSE;
+
   VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
   colorBlendAttachment.colorWriteMask =
       VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
@@ -591,13 +1197,15 @@ void Application::createGraphicsPipeline() {
 
   VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 0;            // Optional
-  pipelineLayoutInfo.pSetLayouts = nullptr;         // Optional
+  // shared with the culling pipeline
+  VkDescriptorSetLayout setLayout = meshletSetLayout;
+  pipelineLayoutInfo.setLayoutCount = drawMesh ? 1 : 0;
+  pipelineLayoutInfo.pSetLayouts = drawMesh ? &setLayout : nullptr;
   pipelineLayoutInfo.pushConstantRangeCount = 0;    // Optional
   pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
 
-  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr,
-                             &pipelineLayout) != VK_SUCCESS) {
+  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, hostAllocator(),
+                             pipelineLayout.replace(device)) != VK_SUCCESS) {
     LOG(ERROR) << "Failed to create pipeline layout!";
   }
 
@@ -610,22 +1218,101 @@ void Application::createGraphicsPipeline() {
   pipelineInfo.pViewportState = &viewportState;
   pipelineInfo.pRasterizationState = &rasterizer;
   pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = nullptr; // Optional
+  pipelineInfo.pDepthStencilState = &depthStencil;
   pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = nullptr; // Optional
+  pipelineInfo.pDynamicState = &dynamicState;
   pipelineInfo.layout = pipelineLayout;
+  // with dynamic rendering the pipeline only needs the attachment formats
+  VkPipelineRenderingCreateInfo renderingInfo = {};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachmentFormats = &swapChainImageFormat;
+  renderingInfo.depthAttachmentFormat = depthFormat;
+  if (dynamicRendering) {
+    pipelineInfo.pNext = &renderingInfo;
+  }
   pipelineInfo.renderPass = renderPass;
   pipelineInfo.subpass = 0;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
   pipelineInfo.basePipelineIndex = -1;
 
   if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                nullptr, &graphicsPipeline) != VK_SUCCESS) {
+                                hostAllocator(),
+                                graphicsPipeline.replace(device)) !=
+      VK_SUCCESS) {
     LOG(ERROR) << "Fail to create graphics pipeline";
   }
 
-  vkDestroyShaderModule(device, vertShaderModule, nullptr);
-  vkDestroyShaderModule(device, fragShaderModule, nullptr);
+  // the depth prepass of occlusion culling: the same vertex stage, no
+  // fragment shader and no color
+  if (occlusionCulling) {
+    pipelineInfo.stageCount = 1;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    colorBlending.attachmentCount = 0;
+    colorBlending.pAttachments = nullptr;
+    renderingInfo.colorAttachmentCount = 0;
+    renderingInfo.pColorAttachmentFormats = nullptr;
+    renderingInfo.depthAttachmentFormat = HiZPyramid::DEPTH_FORMAT;
+    pipelineInfo.renderPass = depthRenderPass;
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                                  hostAllocator(),
+                                  depthPrepassPipeline.replace(device)) !=
+        VK_SUCCESS) {
+      LOG(ERROR) << "Fail to create depth prepass pipeline";
+    }
+  }
+
+  vkDestroyShaderModule(device, vertShaderModule, hostAllocator());
+  vkDestroyShaderModule(device, fragShaderModule, hostAllocator());
+}
+
+void Application::createCullPipeline() {
+  TRACE_SCOPE("createCullPipeline");
+  if (mesh.lods.empty()) {
+    return;
+  }
+  auto compShaderCode = readFile(occlusionCulling
+                                     ? "meshlet_cull.occlusion.comp.spv"
+                                     : "meshlet_cull.comp.spv");
+  VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+  SpecializationConstants constants;
+  constants.set(0, MESHLET_CULL_GROUP_SIZE);
+  constants.set(1, static_cast<uint32_t>(mesh.lods.size()));
+  SpecializationConstants lateConstants = constants;
+  if (occlusionCulling) {
+    constants.set(2, VkBool32(VK_FALSE));
+    lateConstants.set(2, VkBool32(VK_TRUE));
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = compShaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.stage.pSpecializationInfo = constants.info();
+  pipelineInfo.layout = pipelineLayout;
+
+  if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                               hostAllocator(), cullPipeline.replace(device)) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create meshlet culling pipeline";
+  }
+
+  // the late pass only differs in the LATE constant
+  if (occlusionCulling) {
+    pipelineInfo.stage.pSpecializationInfo = lateConstants.info();
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                                 hostAllocator(),
+                                 lateCullPipeline.replace(device)) !=
+        VK_SUCCESS) {
+      LOG(ERROR) << "Fail to create late meshlet culling pipeline";
+    }
+  }
+
+  vkDestroyShaderModule(device, compShaderModule, hostAllocator());
 }
 
 VkShaderModule Application::createShaderModule(const std::vector<char> &code) {
@@ -635,180 +1322,1359 @@ VkShaderModule Application::createShaderModule(const std::vector<char> &code) {
 
   createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
   VkShaderModule shaderModule;
-  if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) !=
-      VK_SUCCESS) {
+  if (vkCreateShaderModule(device, &createInfo, hostAllocator(),
+                           &shaderModule) != VK_SUCCESS) {
     LOG(ERROR) << "Fail to create shader module.";
   }
   return shaderModule;
 }
 
 void Application::createRenderPass() {
-  VkAttachmentDescription colorAttachment = {};
-  colorAttachment.format = swapChainImageFormat;
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  if (dynamicRendering) {
+    return;
+  }
+  // 0: color, 1: depth, 2: the single sampled color resolves into with MSAA.
+  // Only the resolved color is stored; with MSAA, color and depth never
+  // need to leave tile memory. Layout transitions and synchronization
+  // around the pass are done by barriers from the render graph.
+  VkAttachmentDescription attachments[3] = {};
+  attachments[0].format = swapChainImageFormat;
+  attachments[0].samples = msaaSamples;
+  attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[0].storeOp = msaaSamples != VK_SAMPLE_COUNT_1_BIT
+                               ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                               : VK_ATTACHMENT_STORE_OP_STORE;
+  attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  attachments[1].format = depthFormat;
+  attachments[1].samples = msaaSamples;
+  attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].initialLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  attachments[2] = attachments[0];
+  attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+  attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 
   VkAttachmentReference colorAttachmentRef = {};
   colorAttachmentRef.attachment = 0;
   colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+  VkAttachmentReference depthAttachmentRef = {};
+  depthAttachmentRef.attachment = 1;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference resolveAttachmentRef = {};
+  resolveAttachmentRef.attachment = 2;
+  resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  const bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
   VkSubpassDescription subPass = {};
   subPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
   subPass.colorAttachmentCount = 1;
   subPass.pColorAttachments = &colorAttachmentRef;
-
-  VkSubpassDependency dependency = {};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-                             VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  subPass.pResolveAttachments = resolve ? &resolveAttachmentRef : nullptr;
+  subPass.pDepthStencilAttachment = &depthAttachmentRef;
 
   VkRenderPassCreateInfo renderPassInfo = {};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = 1;
-  renderPassInfo.pAttachments = &colorAttachment;
+  renderPassInfo.attachmentCount = resolve ? 3 : 2;
+  renderPassInfo.pAttachments = attachments;
   renderPassInfo.subpassCount = 1;
   renderPassInfo.pSubpasses = &subPass;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
+  renderPassInfo.dependencyCount = 0;
+  renderPassInfo.pDependencies = nullptr;
 
-  if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) !=
-      VK_SUCCESS) {
+  if (vkCreateRenderPass(device, &renderPassInfo, hostAllocator(),
+                         renderPass.replace(device)) != VK_SUCCESS) {
     LOG(ERROR) << "failed to create render pass!";
   }
+
+  if (!occlusionCulling) {
+    return;
+  }
+  // the depth prepass keeps its depth for the Hi-Z reduction
+  VkAttachmentDescription depthAttachment = {};
+  depthAttachment.format = HiZPyramid::DEPTH_FORMAT;
+  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.initialLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  depthAttachment.finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  depthAttachmentRef.attachment = 0;
+  VkSubpassDescription depthSubPass = {};
+  depthSubPass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  depthSubPass.pDepthStencilAttachment = &depthAttachmentRef;
+
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &depthAttachment;
+  renderPassInfo.pSubpasses = &depthSubPass;
+  if (vkCreateRenderPass(device, &renderPassInfo, hostAllocator(),
+                         depthRenderPass.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "failed to create depth prepass render pass!";
+  }
 }
 
 void Application::createFramebuffers() {
-  swapChainFramebuffers.resize(swapChainImageViews.size());
-  for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-    VkImageView attachments[] = {swapChainImageViews[i]};
+  if (dynamicRendering) {
+    return;
+  }
+  for (Window &window : windows) {
+    const RenderGraph &renderGraph = window.renderGraph;
+    // laid out as the render pass attachments: the pass target is either
+    // drawn to directly or resolved into
+    auto create = [&](VkImageView target, UniqueFramebuffer &framebuffer) {
+      VkImageView attachments[3] = {target,
+                                    renderGraph.getImageView(window.depth),
+                                    target};
+      if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+        attachments[0] = renderGraph.getImageView(window.msaaColor);
+      }
 
-    VkFramebufferCreateInfo framebufferInfo = {};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = renderPass;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.pAttachments = attachments;
-    framebufferInfo.width = swapChainExtent.width;
-    framebufferInfo.height = swapChainExtent.height;
-    framebufferInfo.layers = 1;
+      VkFramebufferCreateInfo framebufferInfo = {};
+      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      framebufferInfo.renderPass = renderPass;
+      framebufferInfo.attachmentCount =
+          msaaSamples != VK_SAMPLE_COUNT_1_BIT ? 3 : 2;
+      framebufferInfo.pAttachments = attachments;
+      framebufferInfo.width = window.extent.width;
+      framebufferInfo.height = window.extent.height;
+      framebufferInfo.layers = 1;
+
+      if (vkCreateFramebuffer(device, &framebufferInfo, hostAllocator(),
+                              framebuffer.replace(device)) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create framebuffer!");
+      }
+    };
+
+    if (occlusionCulling) {
+      VkImageView depth = renderGraph.getImageView(window.hizDepth);
+      VkFramebufferCreateInfo framebufferInfo = {};
+      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      framebufferInfo.renderPass = depthRenderPass;
+      framebufferInfo.attachmentCount = 1;
+      framebufferInfo.pAttachments = &depth;
+      framebufferInfo.width = window.extent.width;
+      framebufferInfo.height = window.extent.height;
+      framebufferInfo.layers = 1;
+      if (vkCreateFramebuffer(device, &framebufferInfo, hostAllocator(),
+                              window.hizFramebuffer.replace(device)) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to create framebuffer!");
+      }
+    }
 
-    if (vkCreateFramebuffer(device, &framebufferInfo, nullptr,
-                            &swapChainFramebuffers[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create framebuffer!");
+    if (window.dynamicResolution) {
+      create(renderGraph.getImageView(window.sceneColor),
+             window.sceneFramebuffer);
+      continue;
+    }
+    window.framebuffers.resize(window.imageViews.size());
+    for (size_t i = 0; i < window.imageViews.size(); i++) {
+      create(window.imageViews[i], window.framebuffers[i]);
     }
   }
 }
 
+void Application::createMeshletResources() {
+  TRACE_SCOPE("createMeshletResources");
+  if (mesh.lods.empty()) {
+    return;
+  }
+  const uint32_t frameCount = slotCount;
+
+  VkDescriptorPoolSize poolSizes[3] = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[0].descriptorCount = 3 * frameCount;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[1].descriptorCount = frameCount;
+  // the Hi-Z pyramid, written by createRenderGraph
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[2].descriptorCount = frameCount;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = occlusionCulling ? 3 : 2;
+  poolInfo.pPoolSizes = poolSizes;
+  poolInfo.maxSets = frameCount;
+  if (vkCreateDescriptorPool(device, &poolInfo, hostAllocator(),
+                             descriptorPool.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Failed to create descriptor pool!";
+    return;
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(frameCount, meshletSetLayout);
+  std::vector<VkDescriptorSet> sets(frameCount);
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = frameCount;
+  allocInfo.pSetLayouts = layouts.data();
+  if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Failed to allocate descriptor sets!";
+    return;
+  }
+
+  meshletFrames.clear();
+  meshletFrames.resize(frameCount);
+  for (uint32_t i = 0; i < frameCount; ++i) {
+    MeshletFrameResources &frame = meshletFrames[i];
+    frame.descriptorSet = sets[i];
+
+    createBuffer(sizeof(MeshletFrame), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 frame.uniformBuffer, frame.uniformMemory);
+    vkMapMemory(device, frame.uniformMemory, 0, sizeof(MeshletFrame), 0,
+                &frame.uniformData);
+    // with occlusion culling the late draws follow the early ones
+    const uint32_t drawCount =
+        occlusionCulling ? 2 * mesh.drawSlots : mesh.drawSlots;
+    createBuffer(drawCount * sizeof(VkDrawIndexedIndirectCommand),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.drawBuffer,
+                 frame.drawMemory);
+    VkDeviceSize instanceBytes =
+        std::max(snapshots[0].scene.size(), 1U) * sizeof(SceneInstance);
+    createBuffer(instanceBytes,
+                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 frame.instanceBuffer, frame.instanceMemory);
+    void *instanceData = nullptr;
+    vkMapMemory(device, frame.instanceMemory, 0, instanceBytes, 0,
+                &instanceData);
+    frame.instanceData = static_cast<SceneInstance *>(instanceData);
+
+    VkDescriptorBufferInfo bufferInfos[4] = {};
+    bufferInfos[0].buffer = mesh.meshletBuffer;
+    bufferInfos[0].range = VK_WHOLE_SIZE;
+    bufferInfos[1].buffer = frame.drawBuffer;
+    bufferInfos[1].range = VK_WHOLE_SIZE;
+    bufferInfos[2].buffer = frame.uniformBuffer;
+    bufferInfos[2].range = sizeof(MeshletFrame);
+    bufferInfos[3].buffer = frame.instanceBuffer;
+    bufferInfos[3].range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet writes[4] = {};
+    for (uint32_t b = 0; b < 4; ++b) {
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = frame.descriptorSet;
+      writes[b].dstBinding = b;
+      writes[b].descriptorCount = 1;
+      writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[b].pBufferInfo = &bufferInfos[b];
+    }
+    writes[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    vkUpdateDescriptorSets(device, 4, writes, 0, nullptr);
+  }
+}
+
+void Application::createRenderGraph(Window &window) {
+  TRACE_SCOPE("createRenderGraph");
+  RenderGraph &renderGraph = window.renderGraph;
+  RenderGraph::ImageDesc backBufferDesc = {swapChainImageFormat, window.extent,
+                                           VK_SAMPLE_COUNT_1_BIT};
+  // the acquire semaphore is waited on at all stages, so color attachment
+  // output included
+  window.backBuffer = renderGraph.importImage(
+      "backBuffer", backBufferDesc, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+  const Window *pWindow = &window;
+  if (!mesh.lods.empty()) {
+    // buffers are not tracked by the graph: the pass only feeds the indirect
+    // draws of the main pass and ends with its own barrier
+    RenderGraph::PassBuilder cullPass =
+        renderGraph
+            .addPass("meshletCull",
+                     [this](VkCommandBuffer commandBuffer, uint32_t slot) {
+                       recordMeshletCull(commandBuffer, slot, cullPipeline);
+                     })
+            .sideEffects();
+    if (occlusionCulling) {
+      // the pyramid survives the frame for the next early pass
+      window.hiz.create(physicalDevice, device, window.extent);
+      RenderGraph::ImageDesc pyramidDesc = {
+          HiZPyramid::FORMAT, window.hiz.extent(), VK_SAMPLE_COUNT_1_BIT};
+      window.hizPyramid = renderGraph.importImage(
+          "hizPyramid", pyramidDesc, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      cullPass.read(window.hizPyramid, ResourceUsage::SampledCompute);
+
+      RenderGraph::ImageDesc depthDesc = {
+          HiZPyramid::DEPTH_FORMAT, window.extent, VK_SAMPLE_COUNT_1_BIT};
+      window.hizDepth = renderGraph.createImage("hizDepth", depthDesc);
+      renderGraph
+          .addPass("depthPrepass",
+                   [this, pWindow](VkCommandBuffer commandBuffer,
+                                   uint32_t slot) {
+                     recordDepthPrepass(commandBuffer, *pWindow, slot);
+                   })
+          .write(window.hizDepth, ResourceUsage::DepthAttachment);
+      HiZPyramid *hiz = &window.hiz;
+      renderGraph
+          .addPass("hizBuild",
+                   [hiz](VkCommandBuffer commandBuffer, uint32_t) {
+                     hiz->recordReduce(commandBuffer);
+                   })
+          .read(window.hizDepth, ResourceUsage::SampledCompute)
+          .write(window.hizPyramid, ResourceUsage::Storage);
+      renderGraph
+          .addPass("meshletCullLate",
+                   [this](VkCommandBuffer commandBuffer, uint32_t slot) {
+                     recordMeshletCull(commandBuffer, slot, lateCullPipeline);
+                   })
+          .read(window.hizPyramid, ResourceUsage::SampledCompute)
+          .sideEffects();
+    }
+  }
+
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, swapChainImageFormat,
+                                      &formatProperties);
+  const VkFormatFeatureFlags blitFeatures =
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  window.dynamicResolution =
+      (formatProperties.optimalTilingFeatures & blitFeatures) ==
+          blitFeatures &&
+      (window.usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+  window.renderExtent = window.extent;
+  if (!window.dynamicResolution) {
+    LOG(WARNING) << "No blit support, dynamic resolution is disabled.";
+  }
+
+  RenderGraph::ResourceId target = window.backBuffer;
+  if (window.dynamicResolution) {
+    // allocated once at full size, only the part in use changes
+    window.sceneColor = renderGraph.createImage("sceneColor", backBufferDesc);
+    target = window.sceneColor;
+  }
+  RenderGraph::PassBuilder mainPass =
+      renderGraph
+          .addPass("main",
+                   [this, pWindow](VkCommandBuffer commandBuffer,
+                                   uint32_t slot) {
+                     recordMainPass(commandBuffer, *pWindow, slot);
+                   })
+          .write(target, ResourceUsage::ColorAttachment);
+  // cleared on load and discarded on store, so lazily allocated memory may
+  // never be backed; the multisampled color is resolved into the target
+  RenderGraph::ImageDesc depthDesc = {depthFormat, window.extent,
+                                      msaaSamples};
+  window.depth = renderGraph.createAttachment("depth", depthDesc);
+  mainPass.write(window.depth, ResourceUsage::DepthAttachment);
+  if (msaaSamples != VK_SAMPLE_COUNT_1_BIT) {
+    RenderGraph::ImageDesc msaaDesc = {swapChainImageFormat, window.extent,
+                                       msaaSamples};
+    window.msaaColor = renderGraph.createAttachment("msaaColor", msaaDesc);
+    mainPass.write(window.msaaColor, ResourceUsage::ColorAttachment);
+  }
+
+  if (window.dynamicResolution) {
+    renderGraph
+        .addPass("upscale",
+                 [this, pWindow](VkCommandBuffer commandBuffer, uint32_t) {
+                   recordUpscale(commandBuffer, *pWindow);
+                 })
+        .read(window.sceneColor, ResourceUsage::TransferSrc)
+        .write(window.backBuffer, ResourceUsage::TransferDst);
+  }
+
+  renderGraph.setPassObserver([this](VkCommandBuffer commandBuffer,
+                                     uint32_t slot, const std::string &pass,
+                                     bool begin) {
+    if (begin) {
+      gpuTrace.begin(commandBuffer, slot, pass);
+    } else {
+      gpuTrace.end(commandBuffer, slot);
+    }
+  });
+  renderGraph.setPipelineBarrier2(cmdPipelineBarrier2);
+  renderGraph.compile(physicalDevice, device);
+
+  if (occlusionCulling) {
+    renderGraph.bindImage(window.hizPyramid, window.hiz.image(),
+                          window.hiz.view());
+    window.hiz.setDepth(renderGraph.getImageView(window.hizDepth));
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = window.hiz.sampler();
+    imageInfo.imageView = window.hiz.view();
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    for (size_t i = 0; i < window.images.size(); ++i) {
+      VkWriteDescriptorSet write = {};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = meshletFrames[window.firstSlot + i].descriptorSet;
+      write.dstBinding = 4;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      write.pImageInfo = &imageInfo;
+      vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    }
+    HiZPyramid *hiz = &window.hiz;
+    submitOneShot("Hi-Z clear", [hiz](VkCommandBuffer commandBuffer) {
+      hiz->recordClear(commandBuffer);
+    });
+  }
+}
+
+void Application::recordUpscale(VkCommandBuffer commandBuffer,
+                                const Window &window) {
+  VkImageBlit region = {};
+  region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.srcOffsets[1] = {static_cast<int32_t>(window.renderExtent.width),
+                          static_cast<int32_t>(window.renderExtent.height), 1};
+  region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.dstOffsets[1] = {static_cast<int32_t>(window.extent.width),
+                          static_cast<int32_t>(window.extent.height), 1};
+  vkCmdBlitImage(commandBuffer, window.renderGraph.getImage(window.sceneColor),
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                 window.renderGraph.getImage(window.backBuffer),
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region,
+                 VK_FILTER_LINEAR);
+}
+
+void Application::updateRenderScale(Window &window, double gpuMilliseconds) {
+  if (!window.dynamicResolution ||
+      !window.resolutionScaler.update(gpuMilliseconds)) {
+    return;
+  }
+  float scale = window.resolutionScaler.scale();
+  window.renderExtent.width = std::max(
+      1U, static_cast<uint32_t>(std::lround(window.extent.width * scale)));
+  window.renderExtent.height = std::max(
+      1U, static_cast<uint32_t>(std::lround(window.extent.height * scale)));
+}
+
+void Application::recordMainPass(VkCommandBuffer commandBuffer,
+                                 const Window &window, uint32_t slot) {
+  VkRect2D renderArea = {{0, 0}, window.renderExtent};
+  // color, depth and the unused resolve target, as the render pass
+  VkClearValue clearValues[3] = {};
+  clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  clearValues[1].depthStencil = {1.0f, 0};
+  const bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+  mainPassQueries.begin(commandBuffer, slot);
+  if (dynamicRendering) {
+    // the graph has already moved the attachments into their layouts
+    const RenderGraph &renderGraph = window.renderGraph;
+    VkImageView target = renderGraph.getImageView(
+        window.dynamicResolution ? window.sceneColor : window.backBuffer);
+    VkRenderingAttachmentInfo colorAttachment = {};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    colorAttachment.imageView = target;
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.clearValue = clearValues[0];
+    if (resolve) {
+      colorAttachment.imageView = renderGraph.getImageView(window.msaaColor);
+      colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+      colorAttachment.resolveImageView = target;
+      colorAttachment.resolveImageLayout =
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    VkRenderingAttachmentInfo depthAttachment = {};
+    depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depthAttachment.imageView = renderGraph.getImageView(window.depth);
+    depthAttachment.imageLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.clearValue = clearValues[1];
+
+    VkRenderingInfo renderingInfo = {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    renderingInfo.renderArea = renderArea;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    renderingInfo.pDepthAttachment = &depthAttachment;
+    cmdBeginRendering(commandBuffer, &renderingInfo);
+  } else {
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer =
+        window.dynamicResolution
+            ? window.sceneFramebuffer.get()
+            : window.framebuffers[slot - window.firstSlot].get();
+    renderPassInfo.renderArea = renderArea;
+    renderPassInfo.clearValueCount = resolve ? 3 : 2;
+    renderPassInfo.pClearValues = clearValues;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
+  }
+  VkViewport viewport = {0.0f,
+                         0.0f,
+                         static_cast<float>(window.renderExtent.width),
+                         static_cast<float>(window.renderExtent.height),
+                         0.0f,
+                         1.0f};
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &renderArea);
+  renderQueue.flush(commandBuffer, QUEUE_PASS_MAIN);
+  if (dynamicRendering) {
+    cmdEndRendering(commandBuffer);
+  } else {
+    vkCmdEndRenderPass(commandBuffer);
+  }
+  mainPassQueries.end(commandBuffer, slot);
+}
+
+void Application::recordDepthPrepass(VkCommandBuffer commandBuffer,
+                                    const Window &window, uint32_t slot) {
+  // the whole buffer is cleared, so the pyramid beyond the render extent
+  // occludes nothing
+  VkRect2D clearArea = {{0, 0}, window.extent};
+  VkRect2D renderArea = {{0, 0}, window.renderExtent};
+  VkClearValue clearValue = {};
+  clearValue.depthStencil = {1.0f, 0};
+  if (dynamicRendering) {
+    VkRenderingAttachmentInfo depthAttachment = {};
+    depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    depthAttachment.imageView =
+        window.renderGraph.getImageView(window.hizDepth);
+    depthAttachment.imageLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.clearValue = clearValue;
+
+    VkRenderingInfo renderingInfo = {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    renderingInfo.renderArea = clearArea;
+    renderingInfo.layerCount = 1;
+    renderingInfo.pDepthAttachment = &depthAttachment;
+    cmdBeginRendering(commandBuffer, &renderingInfo);
+  } else {
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = depthRenderPass;
+    renderPassInfo.framebuffer = window.hizFramebuffer;
+    renderPassInfo.renderArea = clearArea;
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearValue;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
+                         VK_SUBPASS_CONTENTS_INLINE);
+  }
+  VkViewport viewport = {0.0f,
+                         0.0f,
+                         static_cast<float>(window.renderExtent.width),
+                         static_cast<float>(window.renderExtent.height),
+                         0.0f,
+                         1.0f};
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &renderArea);
+  // only what the early pass kept
+  renderQueue.flush(commandBuffer, QUEUE_PASS_DEPTH);
+  if (dynamicRendering) {
+    cmdEndRendering(commandBuffer);
+  } else {
+    vkCmdEndRenderPass(commandBuffer);
+  }
+}
+
+void Application::recordMeshletCull(VkCommandBuffer commandBuffer,
+                                    uint32_t slot, VkPipeline pipeline) {
+  const MeshletFrameResources &frame = meshletFrames[slot];
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout, 0, 1, &frame.descriptorSet, 0,
+                          nullptr);
+  vkCmdDispatch(commandBuffer,
+                (mesh.drawSlots + MESHLET_CULL_GROUP_SIZE - 1) /
+                    MESHLET_CULL_GROUP_SIZE,
+                1, 1);
+
+  if (cmdPipelineBarrier2 != nullptr) {
+    VkBufferMemoryBarrier2 barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    // the late culling pass reads the early draws
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT |
+                            VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = frame.drawBuffer;
+    barrier.size = VK_WHOLE_SIZE;
+    VkDependencyInfo dependency = {};
+    dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency.bufferMemoryBarrierCount = 1;
+    dependency.pBufferMemoryBarriers = &barrier;
+    cmdPipelineBarrier2(commandBuffer, &dependency);
+    return;
+  }
+
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = frame.drawBuffer;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void Application::createScene() {
+  TRACE_SCOPE("createScene");
+  if (mesh.lods.empty()) {
+    return;
+  }
+  glm::vec3 boundsMin(mesh.boundsMin[0], mesh.boundsMin[1],
+                      mesh.boundsMin[2]);
+  glm::vec3 boundsMax(mesh.boundsMax[0], mesh.boundsMax[1],
+                      mesh.boundsMax[2]);
+  glm::vec4 bounds((boundsMin + boundsMax) * 0.5f,
+                   glm::length(boundsMax - boundsMin) * 0.5f);
+  // entities rotate about the mesh origin, which need not be its center
+  float extent = std::max(glm::length(glm::vec3(bounds)) + bounds.w, 1e-3f);
+  float spacing = extent * 8.0f;
+  float offset = (SCENE_GRID - 1) * 0.5f;
+
+  Scene &scene = snapshots[0].scene;
+  sceneRoots.clear();
+  for (uint32_t z = 0; z < SCENE_GRID; ++z) {
+    for (uint32_t x = 0; x < SCENE_GRID; ++x) {
+      glm::vec3 position((x - offset) * spacing, 0.0f, (z - offset) * spacing);
+      Scene::EntityId root =
+          scene.createEntity(Scene::NO_PARENT, position, glm::quat(),
+                             glm::vec3(1.0f), bounds);
+      sceneRoots.push_back(root);
+      for (uint32_t c = 0; c < SCENE_CLUSTER_CHILDREN; ++c) {
+        float angle = 6.2831853f * c / SCENE_CLUSTER_CHILDREN;
+        glm::vec3 orbit(std::cos(angle) * extent * 2.5f, 0.0f,
+                        std::sin(angle) * extent * 2.5f);
+        scene.createEntity(root, orbit,
+                           glm::angleAxis(angle, glm::vec3(0.0f, 1.0f, 0.0f)),
+                           glm::vec3(0.4f), bounds);
+      }
+    }
+  }
+  scene.updateTransforms();
+  snapshots[1].scene = scene;
+  LOG(INFO) << "Scene: " << scene.size() << " entities";
+}
+
+void Application::updateScene(SceneSnapshot &snapshot, float time) {
+  TRACE_SCOPE("updateScene");
+  snapshot.time = time;
+  if (sceneRoots.empty()) {
+    return;
+  }
+  // spinning the roots carries their children around them
+  for (size_t i = 0; i < sceneRoots.size(); ++i) {
+    float angle = time * 0.5f + static_cast<float>(i) * 0.37f;
+    snapshot.scene.setRotation(
+        sceneRoots[i], glm::angleAxis(angle, glm::vec3(0.0f, 1.0f, 0.0f)));
+  }
+  snapshot.scene.updateTransforms();
+}
+
+void Application::updateMeshletFrame(Window &window, uint32_t slot,
+                                     const SceneSnapshot &snapshot) {
+  TRACE_SCOPE("updateMeshletFrame");
+  const Scene &scene = snapshot.scene;
+  const float fov = glm::radians(45.0f);
+  glm::vec3 boundsMin(mesh.boundsMin[0], mesh.boundsMin[1],
+                      mesh.boundsMin[2]);
+  glm::vec3 boundsMax(mesh.boundsMax[0], mesh.boundsMax[1],
+                      mesh.boundsMax[2]);
+  float meshRadius =
+      std::max(glm::length(boundsMax - boundsMin) * 0.5f, 1e-3f);
+
+  // orbit the scene and dolly in and out so every LOD gets used
+  glm::vec3 sceneMin = glm::vec3(scene.worldBounds(sceneRoots.front()));
+  glm::vec3 sceneMax = glm::vec3(scene.worldBounds(sceneRoots.back()));
+  glm::vec3 center = (sceneMin + sceneMax) * 0.5f;
+  float sceneRadius =
+      std::max(glm::length(sceneMax - sceneMin) * 0.5f, meshRadius);
+  float time = snapshot.time;
+  float distance = sceneRadius * (0.9f + 0.7f * std::sin(time * 0.2f));
+  // windows look at the scene from evenly spaced angles
+  float angle = time * 0.1f + 6.2831853f *
+                                  static_cast<float>(&window - &windows[0]) /
+                                  static_cast<float>(windows.size());
+  glm::vec3 eye =
+      center + distance * glm::normalize(glm::vec3(std::sin(angle), 0.35f,
+                                                   std::cos(angle)));
+
+  const float nearPlane = meshRadius * 0.01f;
+  glm::mat4 view = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 projection = glm::perspective(
+      fov,
+      static_cast<float>(window.extent.width) /
+          static_cast<float>(window.extent.height),
+      nearPlane, distance + sceneRadius * 2.0f);
+  // Vulkan clip space has y pointing down
+  projection[1][1] *= -1.0f;
+
+  MeshletFrame frame = {};
+  frame.viewProj = projection * view;
+  // Gribb/Hartmann plane extraction, rows of viewProj
+  const glm::mat4 &m = frame.viewProj;
+  for (int i = 0; i < 3; ++i) {
+    glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+    glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+    frame.frustum[i * 2] = w + row;
+    frame.frustum[i * 2 + 1] = w - row;
+  }
+  // depth is [0, 1], so the near plane is the z row alone
+  frame.frustum[4] = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+  for (auto &plane : frame.frustum) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  frame.cameraPosition = glm::vec4(eye, 1.0f);
+  frame.boundsMin = glm::vec4(boundsMin, 0.0f);
+  frame.boundsExtent = glm::vec4(boundsMax - boundsMin, 0.0f);
+
+  // each visible instance takes the coarsest LOD whose error stays below
+  // LOD_PIXEL_ERROR pixels at the closest point of its bounding sphere
+  const float pixelScale =
+      static_cast<float>(window.renderExtent.height) * 0.5f /
+      std::tan(fov * 0.5f);
+  const uint32_t lodCount = static_cast<uint32_t>(mesh.lods.size());
+  auto classify = [&](const glm::vec4 &bounds) -> uint32_t {
+    if (!drawIndirectFirstInstance) {
+      return 0;
+    }
+    float scale = bounds.w / meshRadius;
+    float nearest = std::max(glm::length(glm::vec3(bounds) - eye) - bounds.w,
+                             nearPlane);
+    float pixelsPerUnit = pixelScale * scale / nearest;
+    uint32_t lod = 0;
+    while (lod + 1 < lodCount &&
+           mesh.lods[lod + 1].error * pixelsPerUnit <= LOD_PIXEL_ERROR) {
+      ++lod;
+    }
+    return lod;
+  };
+  uint32_t instanceCounts[MESH_MAX_LODS];
+  scene.gatherVisible(frame.frustum, lodCount, classify,
+                      meshletFrames[slot].instanceData, scene.size(),
+                      instanceCounts);
+
+  uint32_t firstInstance = 0;
+  for (uint32_t lod = 0; lod < lodCount; ++lod) {
+    frame.lods[lod][0] = mesh.lods[lod].firstMeshlet;
+    frame.lods[lod][1] = mesh.lods[lod].meshletCount;
+    frame.lods[lod][2] = firstInstance;
+    frame.lods[lod][3] = instanceCounts[lod];
+    firstInstance += instanceCounts[lod];
+  }
+  frame.lodCount = lodCount;
+  frame.drawCount = mesh.drawSlots;
+  // all zero on the first frame, which occludes nothing
+  frame.previousViewProj = window.previousViewProj;
+  frame.hizExtent = glm::vec4(window.renderExtent.width,
+                              window.renderExtent.height,
+                              window.previousRenderExtent.width,
+                              window.previousRenderExtent.height);
+  window.previousViewProj = frame.viewProj;
+  window.previousRenderExtent = window.renderExtent;
+
+  std::memcpy(meshletFrames[slot].uniformData, &frame, sizeof(frame));
+}
+
 void Application::createCommandPool(const QueueFamilyIndices &indices) {
   VkCommandPoolCreateInfo poolInfo = {};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
   poolInfo.queueFamilyIndex = indices.getIndex(QueueFamilyIndices::GRAPHICS);
-  poolInfo.flags = 0;
+  // frame command buffers are re-recorded when the render resolution changes
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-  if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) !=
-      VK_SUCCESS) {
+  if (vkCreateCommandPool(device, &poolInfo, hostAllocator(),
+                          commandPool.replace(device)) != VK_SUCCESS) {
     LOG(ERROR) << "failed to create command pool!";
   }
 }
 
-void Application::createCommandBuffers() {
-  commandBuffers.resize(swapChainFramebuffers.size());
+uint32_t Application::findMemoryType(uint32_t typeBits,
+                                     VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+    if ((typeBits & (1U << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+  throw std::runtime_error("Failed to find a suitable memory type!");
+}
 
+void Application::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                               VkMemoryPropertyFlags properties,
+                               UniqueBuffer &buffer,
+                               UniqueDeviceMemory &memory) {
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(device, &bufferInfo, hostAllocator(),
+                     buffer.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create buffer.";
+    return;
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device, buffer, &requirements);
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = requirements.size;
+  allocInfo.memoryTypeIndex =
+      findMemoryType(requirements.memoryTypeBits, properties);
+  if (allocateDeviceMemory(device, &allocInfo, hostAllocator(),
+                           memory.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to allocate buffer memory.";
+    return;
+  }
+  vkBindBufferMemory(device, buffer, memory, 0);
+}
+
+void Application::submitOneShot(
+    const char *what, const std::function<void(VkCommandBuffer)> &record) {
   VkCommandBufferAllocateInfo allocInfo = {};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
   allocInfo.commandPool = commandPool;
   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+  allocInfo.commandBufferCount = 1;
+  VkCommandBuffer commandBuffer;
+  if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "failed to allocate " << what << " command buffer!";
+    return;
+  }
 
-  if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) !=
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  record(commandBuffer);
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    LOG(ERROR) << "failed to record " << what << " command buffer!";
+  }
+
+  // no wait: frames are submitted to the same queue after this, so the
+  // work has finished by the time frame `frameNumber` retires
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
       VK_SUCCESS) {
-    LOG(ERROR) << "failed to allocate command buffers!";
+    LOG(ERROR) << "Fail to submit " << what << ".";
   }
 
-  for (size_t i = 0; i < commandBuffers.size(); i++) {
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-    beginInfo.pInheritanceInfo = nullptr; // Optional
+  VkDevice dev = device;
+  VkCommandPool pool = commandPool;
+  deletionQueue.push(frameNumber, [dev, pool, commandBuffer]() {
+    vkFreeCommandBuffers(dev, pool, 1, &commandBuffer);
+  });
+}
 
-    vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+void Application::loadMesh(const std::string &path) {
+  TRACE_SCOPE("loadMesh");
+  MappedMesh file(path);
+  const MeshHeader &header = file.header();
 
-    VkRenderPassBeginInfo renderPassInfo = {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapChainFramebuffers[i];
-    renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = swapChainExtent;
-    VkClearValue clearColor{0.0f, 0.0f, 0.0f, 1.0f};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
-    vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      graphicsPipeline);
-    vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
-    vkCmdEndRenderPass(commandBuffers[i]);
+  if (header.lodCount == 0 || header.meshletCount == 0) {
+    LOG(ERROR) << "Mesh " << path << " has no meshlets.";
+    return;
+  }
 
-    if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-      LOG(ERROR) << "failed to record command buffer!";
+  createBuffer(file.vertexDataSize(),
+               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.vertexBuffer,
+               mesh.vertexMemory);
+  createBuffer(file.indexDataSize(),
+               VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.indexBuffer,
+               mesh.indexMemory);
+  createBuffer(file.meshletDataSize(),
+               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.meshletBuffer,
+               mesh.meshletMemory);
+
+  // Every section is streamed through the ring in chunks of a quarter of
+  // it. When the ring is full, the copies so far are submitted and waited
+  // for, then collected; this runs ahead of the first frame, so nothing
+  // else holds ring space. The copies are tagged with frame `frameNumber`.
+  struct Copy {
+    VkBuffer source;
+    VkBuffer destination;
+    VkBufferCopy region;
+  };
+  std::vector<Copy> copies;
+  auto submitCopies = [&](bool last) {
+    submitOneShot("mesh upload", [&](VkCommandBuffer commandBuffer) {
+      for (const Copy &copy : copies) {
+        vkCmdCopyBuffer(commandBuffer, copy.source, copy.destination, 1,
+                        &copy.region);
+      }
+      if (!last) {
+        return;
+      }
+      VkBufferMemoryBarrier barriers[3] = {};
+      for (auto &barrier : barriers) {
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.size = VK_WHOLE_SIZE;
+      }
+      barriers[0].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+      barriers[0].buffer = mesh.vertexBuffer;
+      barriers[1].dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
+      barriers[1].buffer = mesh.indexBuffer;
+      barriers[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      barriers[2].buffer = mesh.meshletBuffer;
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           0, 0, nullptr, 3, barriers, 0, nullptr);
+    });
+    copies.clear();
+  };
+  const VkDeviceSize chunkSize = stagingRing.capacity() / 4;
+  auto stream = [&](const void *data, VkDeviceSize size,
+                    VkBuffer destination) {
+    const char *source = static_cast<const char *>(data);
+    for (VkDeviceSize offset = 0; offset < size; offset += chunkSize) {
+      VkDeviceSize bytes = std::min(chunkSize, size - offset);
+      StagingRing::Allocation staging;
+      if (!stagingRing.allocate(bytes, 16, frameNumber, staging)) {
+        TRACE_SCOPE("waitMeshUpload");
+        submitCopies(false);
+        vkQueueWaitIdle(graphicsQueue);
+        stagingRing.collect(frameNumber);
+        if (!stagingRing.allocate(bytes, 16, frameNumber, staging)) {
+          return false;
+        }
+      }
+      std::memcpy(staging.data, source + offset, bytes);
+      copies.push_back(
+          {staging.buffer, destination, {staging.offset, offset, bytes}});
     }
+    return true;
+  };
+  if (chunkSize == 0 ||
+      !stream(file.vertexData(), file.vertexDataSize(), mesh.vertexBuffer) ||
+      !stream(file.indexData(), file.indexDataSize(), mesh.indexBuffer) ||
+      !stream(file.meshlets(), file.meshletDataSize(), mesh.meshletBuffer)) {
+    LOG(ERROR) << "Fail to stage mesh " << path << ".";
+    submitCopies(false);
+    vkQueueWaitIdle(graphicsQueue);
+    mesh = GpuMesh();
+    return;
+  }
+  submitCopies(true);
+
+  mesh.vertexCount = header.vertexCount;
+  mesh.indexCount = header.indexCount;
+  mesh.indexType =
+      header.indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  std::memcpy(mesh.boundsMin, header.boundsMin, sizeof(mesh.boundsMin));
+  std::memcpy(mesh.boundsMax, header.boundsMax, sizeof(mesh.boundsMax));
+  mesh.lods.assign(file.lods(), file.lods() + header.lodCount);
+  mesh.drawSlots = header.meshletCount;
+
+  LOG(INFO) << "Loaded mesh " << path << ": " << header.vertexCount
+            << " vertices, " << mesh.lods[0].indexCount / 3
+            << " triangles, " << header.lodCount << " LODs, "
+            << header.meshletCount << " meshlets";
+}
+
+void Application::buildRenderQueue(uint32_t slot) {
+  renderQueue.clear();
+  if (mesh.lods.empty()) {
+    DrawPacket triangle;
+    triangle.sortKey =
+        RenderQueue::makeSortKey(QUEUE_PASS_MAIN, QUEUE_PIPELINE_MAIN, 0, 0.0f);
+    triangle.pipeline = graphicsPipeline;
+    triangle.layout = pipelineLayout;
+    triangle.count = 3;
+    renderQueue.push(triangle);
+  } else {
+    // the early pass's draws, then with occlusion culling the late pass's
+    // in the second half of the draw buffer; the prepass only has the first
+    pushMeshletDraws(slot, QUEUE_PASS_MAIN, QUEUE_PIPELINE_MAIN,
+                     graphicsPipeline, 0);
+    if (occlusionCulling) {
+      pushMeshletDraws(slot, QUEUE_PASS_MAIN, QUEUE_PIPELINE_MAIN,
+                       graphicsPipeline, mesh.drawSlots);
+      pushMeshletDraws(slot, QUEUE_PASS_DEPTH, QUEUE_PIPELINE_DEPTH,
+                       depthPrepassPipeline, 0);
+    }
+  }
+  renderQueue.sort();
+}
+
+void Application::pushMeshletDraws(uint32_t slot, uint32_t pass,
+                                   uint32_t pipelineId, VkPipeline pipeline,
+                                   uint32_t drawBase) {
+  const MeshletFrameResources &frame = meshletFrames[slot];
+  DrawPacket packet;
+  packet.pipeline = pipeline;
+  packet.layout = pipelineLayout;
+  packet.descriptorSet = frame.descriptorSet;
+  packet.vertexBuffer = mesh.vertexBuffer;
+  packet.instanceBuffer = frame.instanceBuffer;
+  packet.indexBuffer = mesh.indexBuffer;
+  packet.indexType = mesh.indexType;
+  packet.indirectBuffer = frame.drawBuffer;
+  // one draw per meshlet, culled ones draw nothing; finer LODs are picked
+  // for nearer instances, so LOD order is roughly front to back
+  const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+  for (uint32_t lod = 0; lod < mesh.lods.size(); ++lod) {
+    const MeshLod &range = mesh.lods[lod];
+    packet.sortKey = RenderQueue::makeSortKey(
+        pass, pipelineId, slot, static_cast<float>(lod));
+    for (uint32_t first = 0; first < range.meshletCount;
+         first += maxDrawIndirectCount) {
+      packet.indirectOffset = (drawBase + range.firstMeshlet + first) * stride;
+      packet.count = std::min(maxDrawIndirectCount, range.meshletCount - first);
+      renderQueue.push(packet);
+    }
+  }
+}
+
+void Application::createCommandBuffers() {
+  TRACE_SCOPE("createCommandBuffers");
+  commandBuffers.resize(slotCount);
+  mainPassQueries.create(device, slotCount, pipelineStatisticsQuery,
+                         occlusionQueryPrecise);
+  gpuTrace.create(instance, physicalDevice, device, graphicsQueueFamily,
+                  slotCount, GPU_TRACE_RANGES, calibratedTimestamps);
+  gpuTrace.calibrate(graphicsQueue, commandPool);
+
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = slotCount;
+
+  if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "failed to allocate command buffers!";
+  }
+
+  recordedExtents.resize(slotCount);
+  renderQueueStats.resize(slotCount);
+  for (Window &window : windows) {
+    for (size_t i = 0; i < window.images.size(); i++) {
+      recordCommandBuffer(window, static_cast<uint32_t>(i));
+    }
+  }
+}
+
+void Application::recordCommandBuffer(Window &window, uint32_t imageIndex) {
+  uint32_t slot = window.firstSlot + imageIndex;
+  VkCommandBuffer commandBuffer = commandBuffers[slot];
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+  beginInfo.pInheritanceInfo = nullptr; // Optional
+
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+  buildRenderQueue(slot);
+  gpuTrace.reset(commandBuffer, slot);
+  // the resolution scaler reads this range; it starts after the acquire
+  // wait, as the submission waits for the image before any stage
+  gpuTrace.begin(commandBuffer, slot, "frame");
+  window.renderGraph.bindImage(window.backBuffer, window.images[imageIndex],
+                               window.imageViews[imageIndex]);
+  window.renderGraph.execute(commandBuffer, slot);
+  gpuTrace.end(commandBuffer, slot);
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    LOG(ERROR) << "failed to record command buffer!";
   }
+  recordedExtents[slot] = window.renderExtent;
+  renderQueueStats[slot] = renderQueue.getStats();
 }
 
-void Application::createSemaphores() {
+void Application::createSyncObjects() {
+  imagesInFlight.assign(slotCount, VK_NULL_HANDLE);
+
   VkSemaphoreCreateInfo semaphoreInfo = {};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-  if (vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                        &imageAvailableSemaphore) != VK_SUCCESS ||
-      vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                        &renderFinishedSemaphore) != VK_SUCCESS) {
-    LOG(ERROR) << "Failed to create semaphores!";
+
+  VkFenceCreateInfo fenceInfo = {};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+  for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    if (vkCreateSemaphore(device, &semaphoreInfo, hostAllocator(),
+                          renderFinishedSemaphores[i].replace(device)) !=
+            VK_SUCCESS ||
+        vkCreateFence(device, &fenceInfo, hostAllocator(),
+                      inFlightFences[i].replace(device)) != VK_SUCCESS) {
+      LOG(ERROR) << "Failed to create synchronization objects!";
+    }
+    for (Window &window : windows) {
+      if (vkCreateSemaphore(
+              device, &semaphoreInfo, hostAllocator(),
+              window.imageAvailableSemaphores[i].replace(device)) !=
+          VK_SUCCESS) {
+        LOG(ERROR) << "Failed to create synchronization objects!";
+      }
+    }
   }
 }
 
-void Application::drawFrame() {
-  vkQueueWaitIdle(presentQueue);
+void Application::drawFrame(const SceneSnapshot &snapshot) {
+  TRACE_SCOPE("drawFrame");
+  VkFence frameFence = inFlightFences[currentFrame];
+  {
+    TRACE_SCOPE("waitFrameFence");
+    vkWaitForFences(device, 1, &frameFence, VK_TRUE,
+                    std::numeric_limits<uint64_t>::max());
+  }
+
+  // the fence of this slot guards frame (frameNumber - MAX_FRAMES_IN_FLIGHT),
+  // and submissions on one queue retire in order
+  if (frameNumber >= MAX_FRAMES_IN_FLIGHT) {
+    deletionQueue.collect(frameNumber - MAX_FRAMES_IN_FLIGHT);
+    stagingRing.collect(frameNumber - MAX_FRAMES_IN_FLIGHT);
+  }
+  memoryBudget.sample();
+  recordFrameMetrics();
+
+  // every acquired window adds its command buffer to one submission
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<VkPipelineStageFlags> waitStages;
+  std::vector<VkCommandBuffer> submitCommandBuffers;
+  std::vector<VkSwapchainKHR> swapChains;
+  std::vector<uint32_t> imageIndices;
+  double gpuMilliseconds = 0.0;
+  bool gpuTimed = false;
+  RenderQueue::Stats queueStats;
+  for (Window &window : windows) {
+    VkSemaphore imageAvailable = window.imageAvailableSemaphores[currentFrame];
+    VkResult result;
+    {
+      TRACE_SCOPE("acquireImage");
+      result = vkAcquireNextImageKHR(
+          device, window.swapChain, std::numeric_limits<uint64_t>::max(),
+          imageAvailable, VK_NULL_HANDLE, &window.imageIndex);
+    }
+    window.acquired = result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR;
+    if (!window.acquired) {
+      LOG(WARNING) << "Fail to acquire swap chain image: " << result;
+      continue;
+    }
+    uint32_t slot = window.firstSlot + window.imageIndex;
+
+    // a previous frame may still be rendering into this image
+    if (imagesInFlight[slot] != VK_NULL_HANDLE) {
+      TRACE_SCOPE("waitImageFence");
+      vkWaitForFences(device, 1, &imagesInFlight[slot], VK_TRUE,
+                      std::numeric_limits<uint64_t>::max());
+    }
+    // the last submission of this image is done, so its queries are ready
+    recordPassQueryMetrics(slot);
+    double windowMilliseconds = 0.0;
+    if (gpuTrace.collect(slot, windowMilliseconds)) {
+      gpuMilliseconds += windowMilliseconds;
+      gpuTimed = true;
+      updateRenderScale(window, windowMilliseconds);
+    }
+    frameMetrics.record(renderScaleMetric, window.resolutionScaler.scale());
+    imagesInFlight[slot] = frameFence;
+
+    // only the command buffer of this image is idle, the others pick up a
+    // new render extent when their image comes around
+    if (recordedExtents[slot].width != window.renderExtent.width ||
+        recordedExtents[slot].height != window.renderExtent.height) {
+      TRACE_SCOPE("recordCommandBuffer");
+      vkResetCommandBuffer(commandBuffers[slot], 0);
+      recordCommandBuffer(window, window.imageIndex);
+    }
+
+    if (!mesh.lods.empty()) {
+      updateMeshletFrame(window, slot, snapshot);
+    }
+    const RenderQueue::Stats &slotStats = renderQueueStats[slot];
+    queueStats.draws += slotStats.draws;
+    queueStats.pipelineBinds += slotStats.pipelineBinds;
+    queueStats.descriptorSetBinds += slotStats.descriptorSetBinds;
+    queueStats.vertexBufferBinds += slotStats.vertexBufferBinds;
+    queueStats.indexBufferBinds += slotStats.indexBufferBinds;
+
+    // Waited on before the whole frame rather than at color attachment
+    // output: otherwise the frame's first timestamp is written before the
+    // wait, and under FIFO up to a vblank of idle time reads as GPU time,
+    // driving the resolution scaler down. Culling and the depth prepass no
+    // longer overlap the wait, which is short next to that.
+    waitSemaphores.push_back(imageAvailable);
+    waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    submitCommandBuffers.push_back(commandBuffers[slot]);
+    swapChains.push_back(window.swapChain);
+    imageIndices.push_back(window.imageIndex);
+  }
+  if (gpuTimed) {
+    frameMetrics.record(gpuTimeMetric, gpuMilliseconds);
+  }
+  frameMetrics.record(renderQueueMetrics[0], queueStats.draws);
+  frameMetrics.record(renderQueueMetrics[1], queueStats.pipelineBinds);
+  frameMetrics.record(renderQueueMetrics[2], queueStats.descriptorSetBinds);
+  frameMetrics.record(renderQueueMetrics[3], queueStats.vertexBufferBinds);
+  frameMetrics.record(renderQueueMetrics[4], queueStats.indexBufferBinds);
 
-  uint32_t imageIndex;
-  vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(),
-                        imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
   VkSubmitInfo submitInfo = {};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  VkSemaphore waitSemaphores[] = {imageAvailableSemaphore};
-  VkPipelineStageFlags waitStages = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = &waitStages;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-
-  VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
-  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+  submitInfo.pWaitSemaphores = waitSemaphores.data();
+  submitInfo.pWaitDstStageMask = waitStages.data();
+  submitInfo.commandBufferCount =
+      static_cast<uint32_t>(submitCommandBuffers.size());
+  submitInfo.pCommandBuffers = submitCommandBuffers.data();
+
+  // with no image acquired the submission only signals the fence, which the
+  // next use of this frame waits for
+  VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
+  submitInfo.signalSemaphoreCount = swapChains.empty() ? 0 : 1;
   submitInfo.pSignalSemaphores = signalSemaphores;
-  if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
-      VK_SUCCESS) {
-    LOG(ERROR) << "Fail to submit draw command buffer.";
-  }
-
-  VkPresentInfoKHR presentInfo = {};
-  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-  presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
-  VkSwapchainKHR swapChains[] = {swapChain};
-  presentInfo.swapchainCount = 1;
-  presentInfo.pSwapchains = swapChains;
-  presentInfo.pImageIndices = &imageIndex;
-  presentInfo.pResults = nullptr;
-  vkQueuePresentKHR(presentQueue, &presentInfo);
+  vkResetFences(device, 1, &frameFence);
+  {
+    TRACE_SCOPE("submit");
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frameFence) !=
+        VK_SUCCESS) {
+      LOG(ERROR) << "Fail to submit draw command buffer.";
+    } else {
+      for (const Window &window : windows) {
+        if (window.acquired) {
+          uint32_t slot = window.firstSlot + window.imageIndex;
+          mainPassQueries.submitted(slot);
+          gpuTrace.submitted(slot);
+        }
+      }
+    }
+  }
+
+  if (!swapChains.empty()) {
+    std::vector<VkResult> results(swapChains.size(), VK_SUCCESS);
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.swapchainCount = static_cast<uint32_t>(swapChains.size());
+    presentInfo.pSwapchains = swapChains.data();
+    presentInfo.pImageIndices = imageIndices.data();
+    presentInfo.pResults = results.data();
+    {
+      TRACE_SCOPE("present");
+      vkQueuePresentKHR(presentQueue, &presentInfo);
+    }
+    // the overall result only reports one of the failures
+    for (size_t i = 0; i < results.size(); ++i) {
+      if (results[i] != VK_SUCCESS) {
+        LOG(WARNING) << "Fail to present swap chain " << i << ": "
+                     << results[i];
+      }
+    }
+  }
+
+  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  ++frameNumber;
+  frameMetrics.endFrame();
+}
+
+void Application::createFrameMetrics() {
+  frameTimeMetric = frameMetrics.add("frame_ms");
+  gpuTimeMetric = frameMetrics.add("gpu_ms");
+  renderScaleMetric = frameMetrics.add("render_scale");
+  heapUsageMetrics.clear();
+  heapBudgetMetrics.clear();
+  for (uint32_t i = 0; i < memoryBudget.heapCount(); ++i) {
+    std::string heap = "heap" + std::to_string(i);
+    heapUsageMetrics.push_back(frameMetrics.add(heap + "_usage_mib"));
+    heapBudgetMetrics.push_back(frameMetrics.add(heap + "_budget_mib"));
+  }
+  const char *mainPassNames[] = {"main_ia_vertices", "main_vs_invocations",
+                                 "main_clip_primitives", "main_fs_invocations",
+                                 "main_samples_passed"};
+  for (uint32_t i = 0; i < 5; ++i) {
+    mainPassMetrics[i] = frameMetrics.add(mainPassNames[i]);
+  }
+  const char *renderQueueNames[] = {
+      "queue_draws", "queue_pipeline_binds", "queue_set_binds",
+      "queue_vertex_buffer_binds", "queue_index_buffer_binds"};
+  for (uint32_t i = 0; i < 5; ++i) {
+    renderQueueMetrics[i] = frameMetrics.add(renderQueueNames[i]);
+  }
+  lastFrameStart = std::chrono::steady_clock::now();
+}
+
+void Application::recordFrameMetrics() {
+  auto now = std::chrono::steady_clock::now();
+  frameMetrics.record(
+      frameTimeMetric,
+      std::chrono::duration<double, std::milli>(now - lastFrameStart).count());
+  lastFrameStart = now;
+  const double mib = 1.0 / (1024.0 * 1024.0);
+  for (uint32_t i = 0; i < memoryBudget.heapCount(); ++i) {
+    frameMetrics.record(heapUsageMetrics[i],
+                        memoryBudget.heap(i).usage * mib);
+    frameMetrics.record(heapBudgetMetrics[i],
+                        memoryBudget.heap(i).budget * mib);
+  }
+}
+
+void Application::recordPassQueryMetrics(uint32_t slot) {
+  PassQueries::Results results;
+  if (!mainPassQueries.read(slot, results)) {
+    return;
+  }
+  if (results.statistics) {
+    // fragment invocations far above vertex invocations point at a fragment
+    // bound frame, and the other way round
+    frameMetrics.record(mainPassMetrics[0],
+                        static_cast<double>(results.inputAssemblyVertices));
+    frameMetrics.record(mainPassMetrics[1],
+                        static_cast<double>(results.vertexShaderInvocations));
+    frameMetrics.record(mainPassMetrics[2],
+                        static_cast<double>(results.clippingPrimitives));
+    frameMetrics.record(mainPassMetrics[3],
+                        static_cast<double>(results.fragmentShaderInvocations));
+  }
+  frameMetrics.record(mainPassMetrics[4],
+                      static_cast<double>(results.samplesPassed));
 }
 
 void Application::QueueFamilyIndices::setIndex(const uint32_t &f,
@@ -0,0 +1,564 @@
+#include "compute_batch.h"
+#include "host_allocator.h"
+#include "logging.h"
+#include "memory_budget.h"
+#include "trace.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+bool findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeBits,
+                    VkMemoryPropertyFlags wanted, uint32_t &memoryType) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+    if ((typeBits & (1U << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags & wanted) == wanted) {
+      memoryType = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+void ComputeBatch::create(VkPhysicalDevice physical, VkDevice dev,
+                          uint32_t computeFamily, uint32_t transferFamily) {
+  physicalDevice = physical;
+  device = dev;
+  families[0] = computeFamily;
+  families[1] = transferFamily;
+  vkGetDeviceQueue(device, computeFamily, 0, &computeQueue);
+  vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  for (int i = 0; i < 3; ++i) {
+    maxGroupCount[i] = properties.limits.maxComputeWorkGroupCount[i];
+  }
+  maxStorageBufferRange = properties.limits.maxStorageBufferRange;
+
+  // command buffers are recorded anew for every job
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = computeFamily;
+  if (vkCreateCommandPool(device, &poolInfo, hostAllocator(),
+                          computePool.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create batch compute command pool.";
+    return;
+  }
+  poolInfo.queueFamilyIndex = transferFamily;
+  if (vkCreateCommandPool(device, &poolInfo, hostAllocator(),
+                          transferPool.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create batch transfer command pool.";
+    return;
+  }
+
+  for (Slot &slot : slots) {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    allocInfo.commandPool = computePool;
+    vkAllocateCommandBuffers(device, &allocInfo, &slot.dispatchCommands);
+    allocInfo.commandPool = transferPool;
+    vkAllocateCommandBuffers(device, &allocInfo, &slot.uploadCommands);
+    vkAllocateCommandBuffers(device, &allocInfo, &slot.downloadCommands);
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    if (vkCreateSemaphore(device, &semaphoreInfo, hostAllocator(),
+                          slot.uploaded.replace(device)) != VK_SUCCESS ||
+        vkCreateSemaphore(device, &semaphoreInfo, hostAllocator(),
+                          slot.dispatched.replace(device)) != VK_SUCCESS ||
+        vkCreateFence(device, &fenceInfo, hostAllocator(),
+                      slot.done.replace(device)) != VK_SUCCESS) {
+      LOG(ERROR) << "Fail to create batch synchronization objects.";
+      return;
+    }
+
+    VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                     MAX_BINDINGS};
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
+    descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPoolInfo.poolSizeCount = 1;
+    descriptorPoolInfo.pPoolSizes = &poolSize;
+    if (vkCreateDescriptorPool(device, &descriptorPoolInfo, hostAllocator(),
+                               slot.descriptorPool.replace(device)) !=
+        VK_SUCCESS) {
+      LOG(ERROR) << "Fail to create batch descriptor pool.";
+      return;
+    }
+  }
+}
+
+void ComputeBatch::destroy() {
+  if (device == VK_NULL_HANDLE) {
+    return;
+  }
+  for (Slot &slot : slots) {
+    VkFence fence = slot.done;
+    if (fence != VK_NULL_HANDLE) {
+      vkWaitForFences(device, 1, &fence, VK_TRUE,
+                      std::numeric_limits<uint64_t>::max());
+    }
+    slot = Slot();
+  }
+  pipelines.clear();
+  computePool.reset();
+  transferPool.reset();
+}
+
+ComputeBatch::Stats ComputeBatch::run(const std::vector<Job> &jobs) {
+  TRACE_SCOPE("ComputeBatch::run");
+  Stats stats = {};
+  auto start = std::chrono::steady_clock::now();
+  // job i uploads and dispatches, then job i - 1 downloads: the transfer
+  // queue moves data of both neighbours while job i computes
+  const Job *previous = nullptr;
+  Slot *previousSlot = nullptr;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const Job &job = jobs[i];
+    Slot &slot = slots[i % SLOTS];
+    const Pipeline *pipeline = withinLimits(job) ? pipelineFor(job) : nullptr;
+    retire(slot);
+    bool uploaded = pipeline != nullptr && submitUpload(slot, job);
+    bool submitted = uploaded && submitDispatch(slot, job, *pipeline);
+    if (uploaded && !submitted) {
+      drain(slot, computeQueue, slot.uploaded);
+    }
+    // even for a failed job, as the next one reuses the previous slot
+    if (previous != nullptr) {
+      submitDownload(*previousSlot, *previous);
+      previous = nullptr;
+    }
+    if (!submitted) {
+      continue;
+    }
+    previous = &job;
+    previousSlot = &slot;
+
+    ++stats.jobs;
+    for (const Binding &binding : job.bindings) {
+      stats.bytes += binding.input != nullptr ? binding.size : 0;
+      stats.bytes += binding.output != nullptr ? binding.size : 0;
+    }
+  }
+  if (previous != nullptr) {
+    submitDownload(*previousSlot, *previous);
+  }
+  for (Slot &slot : slots) {
+    retire(slot);
+  }
+
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  stats.gigabytesPerSecond =
+      stats.seconds > 0.0 ? static_cast<double>(stats.bytes) / stats.seconds /
+                                1e9
+                          : 0.0;
+  LOG(INFO) << "Batch: " << stats.jobs << " jobs, " << stats.bytes
+            << " bytes in " << stats.seconds << " s, "
+            << stats.gigabytesPerSecond << " GB/s";
+  return stats;
+}
+
+bool ComputeBatch::withinLimits(const Job &job) const {
+  for (int i = 0; i < 3; ++i) {
+    if (job.groupCount[i] > maxGroupCount[i]) {
+      LOG(ERROR) << "Batch job " << job.shader << " dispatches "
+                 << job.groupCount[i] << " groups along axis " << i
+                 << ", the device at most " << maxGroupCount[i];
+      return false;
+    }
+  }
+  for (const Binding &binding : job.bindings) {
+    if (binding.size == 0 || binding.size > maxStorageBufferRange) {
+      LOG(ERROR) << "Batch job " << job.shader << " binds " << binding.size
+                 << " bytes, the device 1 to " << maxStorageBufferRange;
+      return false;
+    }
+  }
+  return true;
+}
+
+const ComputeBatch::Pipeline *ComputeBatch::pipelineFor(const Job &job) {
+  const uint32_t bindingCount = static_cast<uint32_t>(job.bindings.size());
+  if (bindingCount > MAX_BINDINGS) {
+    LOG(ERROR) << "Batch job " << job.shader << " has more than "
+               << MAX_BINDINGS << " bindings.";
+    return nullptr;
+  }
+  auto found = pipelines.find(job.shader);
+  if (found != pipelines.end()) {
+    if (found->second.bindingCount != bindingCount) {
+      LOG(ERROR) << "Batch job " << job.shader << " has " << bindingCount
+                 << " bindings, its pipeline " << found->second.bindingCount;
+      return nullptr;
+    }
+    return found->second.pipeline ? &found->second : nullptr;
+  }
+
+  // a failed shader stays in the map without a pipeline
+  Pipeline &pipeline = pipelines[job.shader];
+  pipeline.bindingCount = bindingCount;
+  VkDescriptorSetLayoutBinding bindings[MAX_BINDINGS] = {};
+  for (uint32_t i = 0; i < bindingCount; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+  setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setLayoutInfo.bindingCount = bindingCount;
+  setLayoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, hostAllocator(),
+                                  pipeline.setLayout.replace(device)) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create batch descriptor set layout.";
+    return nullptr;
+  }
+  VkDescriptorSetLayout setLayout = pipeline.setLayout;
+  VkPipelineLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  if (vkCreatePipelineLayout(device, &layoutInfo, hostAllocator(),
+                             pipeline.layout.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create batch pipeline layout.";
+    return nullptr;
+  }
+
+  auto code = readFile(job.shader);
+  VkShaderModuleCreateInfo moduleInfo = {};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = code.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+  UniqueShaderModule module;
+  if (code.empty() ||
+      vkCreateShaderModule(device, &moduleInfo, hostAllocator(),
+                           module.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create shader module from " << job.shader;
+    return nullptr;
+  }
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = module;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipeline.layout;
+  if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                               hostAllocator(),
+                               pipeline.pipeline.replace(device)) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create batch pipeline for " << job.shader;
+    return nullptr;
+  }
+  return &pipeline;
+}
+
+bool ComputeBatch::reserve(Buffer &buffer, VkDeviceSize size,
+                           VkBufferUsageFlags usage, bool host) {
+  if (buffer.buffer && buffer.size >= size) {
+    return true;
+  }
+  if (buffer.data != nullptr) {
+    vkUnmapMemory(device, buffer.memory);
+    buffer.data = nullptr;
+  }
+  buffer.buffer.reset();
+  buffer.memory.reset();
+  buffer.size = 0;
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  // device buffers are used by both queues, staging buffers only by the
+  // transfer queue
+  if (!host && families[0] != families[1]) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = families;
+  } else {
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  }
+  if (vkCreateBuffer(device, &bufferInfo, hostAllocator(),
+                     buffer.buffer.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create batch buffer.";
+    return false;
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device, buffer.buffer, &requirements);
+  const VkMemoryPropertyFlags coherent = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  // cached memory makes reading the downloads back fast
+  uint32_t memoryType = 0;
+  bool found = findMemoryType(
+      physicalDevice, requirements.memoryTypeBits,
+      host ? coherent | VK_MEMORY_PROPERTY_HOST_CACHED_BIT
+           : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      memoryType);
+  if (host && !found) {
+    found = findMemoryType(physicalDevice, requirements.memoryTypeBits,
+                           coherent, memoryType);
+  }
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = requirements.size;
+  allocInfo.memoryTypeIndex = memoryType;
+  if (!found ||
+      allocateDeviceMemory(device, &allocInfo, hostAllocator(),
+                           buffer.memory.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to allocate " << size << " bytes of batch memory.";
+    buffer.buffer.reset();
+    return false;
+  }
+  vkBindBufferMemory(device, buffer.buffer, buffer.memory, 0);
+  if (host && vkMapMemory(device, buffer.memory, 0, size, 0, &buffer.data) !=
+                  VK_SUCCESS) {
+    LOG(ERROR) << "Fail to map batch staging memory.";
+    return false;
+  }
+  buffer.size = size;
+  return true;
+}
+
+void ComputeBatch::retire(Slot &slot) {
+  VkFence fence = slot.done;
+  {
+    TRACE_SCOPE("waitBatchSlot");
+    vkWaitForFences(device, 1, &fence, VK_TRUE,
+                    std::numeric_limits<uint64_t>::max());
+  }
+  if (slot.pending == nullptr) {
+    return;
+  }
+  const char *data = static_cast<const char *>(slot.download.data);
+  VkDeviceSize offset = 0;
+  for (const Binding &binding : slot.pending->bindings) {
+    if (binding.output != nullptr) {
+      std::memcpy(binding.output, data + offset, binding.size);
+      offset += binding.size;
+    }
+  }
+  slot.pending = nullptr;
+}
+
+bool ComputeBatch::submitUpload(Slot &slot, const Job &job) {
+  VkDeviceSize uploadSize = 0;
+  VkDeviceSize downloadSize = 0;
+  for (uint32_t i = 0; i < job.bindings.size(); ++i) {
+    const Binding &binding = job.bindings[i];
+    if (!reserve(slot.bindings[i], binding.size,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 false)) {
+      return false;
+    }
+    uploadSize += binding.input != nullptr ? binding.size : 0;
+    downloadSize += binding.output != nullptr ? binding.size : 0;
+  }
+  // zero sized buffers are invalid, so both exist even if unused
+  if (!reserve(slot.upload, std::max<VkDeviceSize>(uploadSize, 1),
+               VK_BUFFER_USAGE_TRANSFER_SRC_BIT, true) ||
+      !reserve(slot.download, std::max<VkDeviceSize>(downloadSize, 1),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT, true)) {
+    return false;
+  }
+
+  VkCommandBuffer commandBuffer = slot.uploadCommands;
+  vkResetCommandBuffer(commandBuffer, 0);
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  char *data = static_cast<char *>(slot.upload.data);
+  VkDeviceSize offset = 0;
+  for (uint32_t i = 0; i < job.bindings.size(); ++i) {
+    const Binding &binding = job.bindings[i];
+    if (binding.input == nullptr) {
+      continue;
+    }
+    std::memcpy(data + offset, binding.input, binding.size);
+    VkBufferCopy region = {offset, 0, binding.size};
+    vkCmdCopyBuffer(commandBuffer, slot.upload.buffer, slot.bindings[i].buffer,
+                    1, &region);
+    offset += binding.size;
+  }
+  vkEndCommandBuffer(commandBuffer);
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  VkSemaphore uploaded = slot.uploaded;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &uploaded;
+  if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Fail to submit batch upload.";
+    return false;
+  }
+  return true;
+}
+
+bool ComputeBatch::submitDispatch(Slot &slot, const Job &job,
+                                  const Pipeline &pipeline) {
+  vkResetDescriptorPool(device, slot.descriptorPool, 0);
+  VkDescriptorSetLayout setLayout = pipeline.setLayout;
+  VkDescriptorSetAllocateInfo setInfo = {};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setInfo.descriptorPool = slot.descriptorPool;
+  setInfo.descriptorSetCount = 1;
+  setInfo.pSetLayouts = &setLayout;
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  if (vkAllocateDescriptorSets(device, &setInfo, &set) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to allocate batch descriptor set.";
+    return false;
+  }
+  VkDescriptorBufferInfo bufferInfos[MAX_BINDINGS] = {};
+  VkWriteDescriptorSet writes[MAX_BINDINGS] = {};
+  const uint32_t bindingCount = pipeline.bindingCount;
+  for (uint32_t i = 0; i < bindingCount; ++i) {
+    bufferInfos[i].buffer = slot.bindings[i].buffer;
+    bufferInfos[i].range = job.bindings[i].size;
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = set;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[i].pBufferInfo = &bufferInfos[i];
+  }
+  vkUpdateDescriptorSets(device, bindingCount, writes, 0, nullptr);
+
+  VkCommandBuffer commandBuffer = slot.dispatchCommands;
+  vkResetCommandBuffer(commandBuffer, 0);
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    pipeline.pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipeline.layout, 0, 1, &set, 0, nullptr);
+  vkCmdDispatch(commandBuffer, job.groupCount[0], job.groupCount[1],
+                job.groupCount[2]);
+  vkEndCommandBuffer(commandBuffer);
+
+  // the semaphores carry the memory dependencies between the queues
+  VkSemaphore uploaded = slot.uploaded;
+  VkSemaphore dispatched = slot.dispatched;
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.waitSemaphoreCount = 1;
+  submitInfo.pWaitSemaphores = &uploaded;
+  submitInfo.pWaitDstStageMask = &waitStage;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &dispatched;
+  if (vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Fail to submit batch dispatch.";
+    return false;
+  }
+  return true;
+}
+
+bool ComputeBatch::submitDownload(Slot &slot, const Job &job) {
+  VkCommandBuffer commandBuffer = slot.downloadCommands;
+  vkResetCommandBuffer(commandBuffer, 0);
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  VkDeviceSize offset = 0;
+  for (uint32_t i = 0; i < job.bindings.size(); ++i) {
+    const Binding &binding = job.bindings[i];
+    if (binding.output == nullptr) {
+      continue;
+    }
+    VkBufferCopy region = {0, offset, binding.size};
+    vkCmdCopyBuffer(commandBuffer, slot.bindings[i].buffer,
+                    slot.download.buffer, 1, &region);
+    offset += binding.size;
+  }
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+  vkEndCommandBuffer(commandBuffer);
+
+  VkSemaphore dispatched = slot.dispatched;
+  VkFence fence = slot.done;
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.waitSemaphoreCount = 1;
+  submitInfo.pWaitSemaphores = &dispatched;
+  submitInfo.pWaitDstStageMask = &waitStage;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  vkResetFences(device, 1, &fence);
+  if (vkQueueSubmit(transferQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to submit batch download.";
+    drain(slot, transferQueue, slot.dispatched);
+    return false;
+  }
+  slot.pending = &job;
+  return true;
+}
+
+void ComputeBatch::drain(Slot &slot, VkQueue queue,
+                         UniqueSemaphore &semaphore) {
+  slot.pending = nullptr;
+  VkSemaphore waitSemaphore = semaphore;
+  VkFence fence = slot.done;
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.waitSemaphoreCount = 1;
+  submitInfo.pWaitSemaphores = &waitSemaphore;
+  submitInfo.pWaitDstStageMask = &waitStage;
+  vkResetFences(device, 1, &fence);
+  if (vkQueueSubmit(queue, 1, &submitInfo, fence) == VK_SUCCESS) {
+    return;
+  }
+  // last resort: wait for both queues and start over with fresh objects
+  LOG(ERROR) << "Fail to drain a batch slot, waiting for the queues.";
+  vkQueueWaitIdle(transferQueue);
+  vkQueueWaitIdle(computeQueue);
+  VkSemaphoreCreateInfo semaphoreInfo = {};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  VkFenceCreateInfo fenceInfo = {};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  if (vkCreateSemaphore(device, &semaphoreInfo, hostAllocator(),
+                        semaphore.replace(device)) != VK_SUCCESS ||
+      vkCreateFence(device, &fenceInfo, hostAllocator(),
+                    slot.done.replace(device)) != VK_SUCCESS) {
+    throw std::runtime_error("Fail to recreate batch synchronization.");
+  }
+}
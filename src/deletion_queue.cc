@@ -0,0 +1,34 @@
+#include "deletion_queue.h"
+
+#include <algorithm>
+
+void DeletionQueue::push(uint64_t retireValue, std::function<void()> deleter) {
+  Entry entry{retireValue, std::move(deleter)};
+  if (entries.empty() || entries.back().retireValue <= retireValue) {
+    entries.push_back(std::move(entry));
+    return;
+  }
+  // keep the queue sorted so collect() only ever looks at the front
+  auto pos = std::upper_bound(entries.begin(), entries.end(), retireValue,
+                              [](uint64_t value, const Entry &e) {
+                                return value < e.retireValue;
+                              });
+  entries.insert(pos, std::move(entry));
+}
+
+void DeletionQueue::collect(uint64_t completedValue) {
+  while (!entries.empty() && entries.front().retireValue <= completedValue) {
+    // pop before running so a deleter may safely push new entries
+    std::function<void()> deleter = std::move(entries.front().deleter);
+    entries.pop_front();
+    deleter();
+  }
+}
+
+void DeletionQueue::flush() {
+  while (!entries.empty()) {
+    std::function<void()> deleter = std::move(entries.front().deleter);
+    entries.pop_front();
+    deleter();
+  }
+}
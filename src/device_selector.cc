@@ -0,0 +1,517 @@
+#include "device_selector.h"
+#include "logging.h"
+#include "utility.h"
+#include "vk_handle.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t BENCH_IMAGE_SIZE = 2048;
+const uint32_t BENCH_GROUP_SIZE = 64;
+
+bool bindMemory(VkPhysicalDevice physicalDevice, VkDevice device,
+                const VkMemoryRequirements &requirements,
+                UniqueDeviceMemory &memory) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  uint32_t memoryType = memoryProperties.memoryTypeCount;
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+    if ((requirements.memoryTypeBits & (1U << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+      memoryType = i;
+      break;
+    }
+  }
+  if (memoryType == memoryProperties.memoryTypeCount) {
+    return false;
+  }
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = requirements.size;
+  allocInfo.memoryTypeIndex = memoryType;
+  // not through allocateDeviceMemory: the memory budget is not created yet,
+  // and would book this against the heaps of the device finally chosen
+  return vkAllocateMemory(device, &allocInfo, hostAllocator(),
+                          memory.replace(device)) == VK_SUCCESS;
+}
+
+// Objects of the compute half of the benchmark. Left empty when the shader
+// cannot be loaded, in which case only the clears are timed.
+struct BenchPipeline {
+  UniqueDescriptorSetLayout setLayout;
+  UniquePipelineLayout layout;
+  UniquePipeline pipeline;
+  UniqueDescriptorPool descriptorPool;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+};
+
+bool createBenchPipeline(VkDevice device, VkBuffer buffer,
+                         BenchPipeline &bench) {
+  std::vector<char> code;
+  try {
+    code = readFile("device_bench.comp.spv");
+  } catch (const std::runtime_error &) {
+    LOG(WARNING) << "Device benchmark: no device_bench.comp.spv, "
+                    "only clears are timed.";
+    return false;
+  }
+  VkShaderModuleCreateInfo moduleInfo = {};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = code.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+  UniqueShaderModule module;
+  if (vkCreateShaderModule(device, &moduleInfo, hostAllocator(),
+                           module.replace(device)) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkDescriptorSetLayoutBinding binding = {};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+  setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setLayoutInfo.bindingCount = 1;
+  setLayoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, hostAllocator(),
+                                  bench.setLayout.replace(device)) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  VkDescriptorSetLayout setLayout = bench.setLayout;
+  VkPipelineLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &setLayout;
+  if (vkCreatePipelineLayout(device, &layoutInfo, hostAllocator(),
+                             bench.layout.replace(device)) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = module;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = bench.layout;
+  if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                               hostAllocator(),
+                               bench.pipeline.replace(device)) != VK_SUCCESS) {
+    return false;
+  }
+
+  VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1};
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool(device, &poolInfo, hostAllocator(),
+                             bench.descriptorPool.replace(device)) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = bench.descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  if (vkAllocateDescriptorSets(device, &allocInfo, &bench.descriptorSet) !=
+      VK_SUCCESS) {
+    return false;
+  }
+
+  VkDescriptorBufferInfo bufferInfo = {buffer, 0, VK_WHOLE_SIZE};
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = bench.descriptorSet;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.pBufferInfo = &bufferInfo;
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  return true;
+}
+
+// milliseconds of the second of two identical submissions, the first one
+// pays for lazy driver work; negative on failure
+double runBenchmark(VkPhysicalDevice physicalDevice, VkDevice device,
+                    uint32_t queueFamily, uint32_t clears,
+                    uint32_t dispatches, uint32_t invocations) {
+  VkQueue queue;
+  vkGetDeviceQueue(device, queueFamily, 0, &queue);
+
+  VkImageCreateInfo imageInfo = {};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+  imageInfo.extent = {BENCH_IMAGE_SIZE, BENCH_IMAGE_SIZE, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  UniqueImage image;
+  UniqueDeviceMemory imageMemory;
+  if (vkCreateImage(device, &imageInfo, hostAllocator(),
+                    image.replace(device)) != VK_SUCCESS) {
+    return -1.0;
+  }
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device, image, &requirements);
+  if (!bindMemory(physicalDevice, device, requirements, imageMemory)) {
+    return -1.0;
+  }
+  vkBindImageMemory(device, image, imageMemory, 0);
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = invocations * sizeof(float);
+  bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  UniqueBuffer buffer;
+  UniqueDeviceMemory bufferMemory;
+  if (vkCreateBuffer(device, &bufferInfo, hostAllocator(),
+                     buffer.replace(device)) != VK_SUCCESS) {
+    return -1.0;
+  }
+  vkGetBufferMemoryRequirements(device, buffer, &requirements);
+  if (!bindMemory(physicalDevice, device, requirements, bufferMemory)) {
+    return -1.0;
+  }
+  vkBindBufferMemory(device, buffer, bufferMemory, 0);
+
+  // the family is chosen for graphics, it may still lack compute
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
+  BenchPipeline bench;
+  bool dispatch = false;
+  if (queueFamily < familyCount &&
+      (families[queueFamily].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+    dispatch = createBenchPipeline(device, buffer, bench);
+  } else {
+    LOG(WARNING) << "Device benchmark: no compute on queue family "
+                 << queueFamily << ", only clears are timed.";
+  }
+
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.queueFamilyIndex = queueFamily;
+  UniqueCommandPool commandPool;
+  if (vkCreateCommandPool(device, &poolInfo, hostAllocator(),
+                          commandPool.replace(device)) != VK_SUCCESS) {
+    return -1.0;
+  }
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+  VkCommandBuffer commandBuffer;
+  if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+      VK_SUCCESS) {
+    return -1.0;
+  }
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  // the contents never matter, so every submission starts from UNDEFINED
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  // every clear and every dispatch writes what the previous one wrote
+  VkMemoryBarrier writeBarrier = {};
+  writeBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  writeBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  writeBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  for (uint32_t i = 0; i < clears; ++i) {
+    if (i > 0) {
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &writeBarrier,
+                           0, nullptr, 0, nullptr);
+    }
+    VkClearColorValue color = {{i / float(clears), 0.0f, 0.0f, 1.0f}};
+    vkCmdClearColorImage(commandBuffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1,
+                         &barrier.subresourceRange);
+  }
+  if (dispatch) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      bench.pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            bench.layout, 0, 1, &bench.descriptorSet, 0,
+                            nullptr);
+    writeBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    writeBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    for (uint32_t i = 0; i < dispatches; ++i) {
+      if (i > 0) {
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &writeBarrier, 0, nullptr, 0, nullptr);
+      }
+      vkCmdDispatch(commandBuffer, invocations / BENCH_GROUP_SIZE, 1, 1);
+    }
+  }
+  vkEndCommandBuffer(commandBuffer);
+
+  VkFenceCreateInfo fenceInfo = {};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  UniqueFence fence;
+  if (vkCreateFence(device, &fenceInfo, hostAllocator(),
+                    fence.replace(device)) != VK_SUCCESS) {
+    return -1.0;
+  }
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+
+  double milliseconds = -1.0;
+  for (int run = 0; run < 2; ++run) {
+    VkFence f = fence;
+    vkResetFences(device, 1, &f);
+    auto start = std::chrono::steady_clock::now();
+    if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS ||
+        vkWaitForFences(device, 1, &f, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+      return -1.0;
+    }
+    milliseconds = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  }
+  return milliseconds;
+}
+
+} // namespace
+
+DeviceSelector::DeviceSelector(VkInstance instance, std::string cachePath)
+    : cachePath(std::move(cachePath)) {
+  getProperties2 =
+      (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(
+          instance, "vkGetPhysicalDeviceProperties2KHR");
+}
+
+DeviceSelector::Uuid
+DeviceSelector::deviceUuid(VkPhysicalDevice device) const {
+  Uuid uuid;
+  if (getProperties2 != nullptr) {
+    VkPhysicalDeviceIDProperties idProperties = {};
+    idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &idProperties;
+    getProperties2(device, &properties);
+    std::memcpy(uuid.data(), idProperties.deviceUUID, VK_UUID_SIZE);
+  } else {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    std::memcpy(uuid.data(), properties.pipelineCacheUUID, VK_UUID_SIZE);
+  }
+  return uuid;
+}
+
+uint64_t DeviceSelector::staticScore(VkPhysicalDevice device) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device, &properties);
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+
+  uint64_t typeScore = 0;
+  switch (properties.deviceType) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    typeScore = 4;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    typeScore = 3;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    typeScore = 2;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_CPU:
+    typeScore = 1;
+    break;
+  default:
+    break;
+  }
+
+  VkDeviceSize deviceLocal = 0;
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+    if (memoryProperties.memoryHeaps[i].flags &
+        VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      deviceLocal += memoryProperties.memoryHeaps[i].size;
+    }
+  }
+
+  // type first, then device local MiB, then limits as a tie breaker
+  return typeScore * (1ULL << 40) + (deviceLocal >> 20) * 1024 +
+         properties.limits.maxImageDimension2D / 64 +
+         properties.limits.maxComputeWorkGroupInvocations / 64;
+}
+
+int DeviceSelector::select(const std::vector<Candidate> &candidates,
+                           bool benchmark) {
+  if (candidates.empty()) {
+    return -1;
+  }
+
+  int chosen = -1;
+  if (benchmark && candidates.size() > 1) {
+    loadCache();
+    bool probed = false;
+    double best = 0.0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(candidates[i].device, &properties);
+      Uuid uuid = deviceUuid(candidates[i].device);
+      auto cached = cachedTimes.find(uuid);
+      bool fromCache = cached != cachedTimes.end();
+      double milliseconds = 0.0;
+      if (fromCache) {
+        milliseconds = cached->second;
+      } else {
+        milliseconds = DeviceSelector::benchmark(candidates[i]);
+        cachedTimes[uuid] = milliseconds;
+        probed = true;
+      }
+      LOG(INFO) << "Device " << properties.deviceName << ": benchmark "
+                << milliseconds << " ms"
+                << (fromCache ? " (cached)" : "");
+      if (milliseconds > 0.0 && (chosen < 0 || milliseconds < best)) {
+        chosen = static_cast<int>(i);
+        best = milliseconds;
+      }
+    }
+    if (probed) {
+      saveCache();
+    }
+  }
+
+  if (chosen < 0) {
+    uint64_t best = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      uint64_t score = staticScore(candidates[i].device);
+      if (chosen < 0 || score > best) {
+        chosen = static_cast<int>(i);
+        best = score;
+      }
+    }
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(candidates[chosen].device, &properties);
+  LOG(INFO) << "Selected device " << properties.deviceName << " of "
+            << candidates.size() << " suitable";
+  return chosen;
+}
+
+double DeviceSelector::benchmark(const Candidate &candidate) {
+  float priority = 1.0f;
+  VkDeviceQueueCreateInfo queueInfo = {};
+  queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queueInfo.queueFamilyIndex = candidate.queueFamily;
+  queueInfo.queueCount = 1;
+  queueInfo.pQueuePriorities = &priority;
+
+  // implementations that expose it require it to be enabled
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(candidate.device, nullptr,
+                                       &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(candidate.device, nullptr,
+                                       &extensionCount, extensions.data());
+  const char *portability = "VK_KHR_portability_subset";
+  bool hasPortability = false;
+  for (const auto &extension : extensions) {
+    if (std::strcmp(extension.extensionName, portability) == 0) {
+      hasPortability = true;
+    }
+  }
+
+  VkDeviceCreateInfo deviceInfo = {};
+  deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  deviceInfo.queueCreateInfoCount = 1;
+  deviceInfo.pQueueCreateInfos = &queueInfo;
+  deviceInfo.enabledExtensionCount = hasPortability ? 1 : 0;
+  deviceInfo.ppEnabledExtensionNames = hasPortability ? &portability : nullptr;
+
+  VkDevice device;
+  if (vkCreateDevice(candidate.device, &deviceInfo, hostAllocator(),
+                     &device) != VK_SUCCESS) {
+    LOG(WARNING) << "Device benchmark: fail to create device.";
+    return -1.0;
+  }
+  double milliseconds =
+      runBenchmark(candidate.device, device, candidate.queueFamily,
+                   BENCH_CLEARS, BENCH_DISPATCHES, BENCH_INVOCATIONS);
+  vkDeviceWaitIdle(device);
+  vkDestroyDevice(device, hostAllocator());
+  return milliseconds;
+}
+
+void DeviceSelector::loadCache() {
+  cachedTimes.clear();
+  std::ifstream file(cachePath);
+  std::string line;
+  while (std::getline(file, line)) {
+    // <deviceUUID as 32 hex digits> <milliseconds>
+    std::istringstream stream(line);
+    std::string hex;
+    double milliseconds = 0.0;
+    if (!(stream >> hex >> milliseconds) || hex.size() != 2 * VK_UUID_SIZE) {
+      continue;
+    }
+    Uuid uuid;
+    bool valid = true;
+    for (uint32_t i = 0; i < VK_UUID_SIZE && valid; ++i) {
+      unsigned int byte = 0;
+      valid = std::sscanf(hex.c_str() + 2 * i, "%2x", &byte) == 1;
+      uuid[i] = static_cast<uint8_t>(byte);
+    }
+    if (valid) {
+      cachedTimes[uuid] = milliseconds;
+    }
+  }
+}
+
+void DeviceSelector::saveCache() const {
+  std::ofstream file(cachePath, std::ios::trunc);
+  if (!file.is_open()) {
+    LOG(WARNING) << "Fail to write device cache " << cachePath;
+    return;
+  }
+  for (const auto &entry : cachedTimes) {
+    char hex[2 * VK_UUID_SIZE + 1];
+    for (uint32_t i = 0; i < VK_UUID_SIZE; ++i) {
+      std::snprintf(hex + 2 * i, 3, "%02x", entry.first[i]);
+    }
+    file << hex << " " << entry.second << "\n";
+  }
+}
@@ -0,0 +1,37 @@
+#include "frame_metrics.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+uint32_t FrameMetrics::add(std::string name) {
+  metrics.push_back({std::move(name), 0.0, 0.0, 0});
+  return static_cast<uint32_t>(metrics.size() - 1);
+}
+
+void FrameMetrics::record(uint32_t id, double value) {
+  Metric &metric = metrics[id];
+  metric.max = metric.samples == 0 ? value : std::max(metric.max, value);
+  metric.sum += value;
+  ++metric.samples;
+}
+
+void FrameMetrics::endFrame() {
+  if (++frames < window) {
+    return;
+  }
+  std::ostringstream line;
+  line << "Frame metrics over " << frames << " frames:";
+  for (auto &metric : metrics) {
+    if (metric.samples == 0) {
+      continue;
+    }
+    line << " " << metric.name << " " << metric.sum / metric.samples
+         << " (max " << metric.max << ")";
+    metric.sum = metric.max = 0.0;
+    metric.samples = 0;
+  }
+  LOG(INFO) << line.str();
+  frames = 0;
+}
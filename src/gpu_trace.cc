@@ -0,0 +1,225 @@
+#include "gpu_trace.h"
+#include "logging.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <limits>
+
+void GpuTrace::create(VkInstance instance, VkPhysicalDevice physicalDevice,
+                      VkDevice dev, uint32_t queueFamily, uint32_t slotCount,
+                      uint32_t ranges, bool calibratedTimestamps) {
+  device = dev;
+  maxRanges = ranges;
+  slots.assign(slotCount, Slot());
+  results.assign(maxRanges * 4, 0);
+  getCalibratedTimestamps = nullptr;
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families.data());
+  uint32_t validBits =
+      queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+  if (validBits == 0) {
+    LOG(WARNING) << "GPU trace: queue family has no timestamp support.";
+    return;
+  }
+  validMask = validBits >= 64 ? ~0ULL : (1ULL << validBits) - 1;
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  period = properties.limits.timestampPeriod;
+
+#ifdef __linux__
+  // traceNow() is steady_clock, which is CLOCK_MONOTONIC here
+  auto getTimeDomains =
+      (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(
+          instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+  if (calibratedTimestamps && getTimeDomains != nullptr) {
+    uint32_t domainCount = 0;
+    getTimeDomains(physicalDevice, &domainCount, nullptr);
+    std::vector<VkTimeDomainEXT> domains(domainCount);
+    getTimeDomains(physicalDevice, &domainCount, domains.data());
+    bool deviceDomain = false, monotonicDomain = false;
+    for (auto domain : domains) {
+      deviceDomain |= domain == VK_TIME_DOMAIN_DEVICE_EXT;
+      monotonicDomain |= domain == VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+    }
+    if (deviceDomain && monotonicDomain) {
+      getCalibratedTimestamps =
+          (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(
+              device, "vkGetCalibratedTimestampsEXT");
+    }
+  }
+#endif
+
+  VkQueryPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  poolInfo.queryCount = slotCount * maxRanges * 2;
+  if (vkCreateQueryPool(device, &poolInfo, hostAllocator(),
+                        queryPool.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create timestamp query pool.";
+    queryPool.release();
+  }
+}
+
+void GpuTrace::destroy() {
+  queryPool.reset();
+  slots.clear();
+}
+
+bool GpuTrace::calibrateWithExtension() {
+  if (getCalibratedTimestamps == nullptr) {
+    return false;
+  }
+  VkCalibratedTimestampInfoEXT infos[2] = {};
+  infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+  infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+  infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+  infos[1].timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+  uint64_t timestamps[2];
+  uint64_t maxDeviation;
+  if (getCalibratedTimestamps(device, 2, infos, timestamps, &maxDeviation) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  offset = static_cast<int64_t>(timestamps[1]) -
+           static_cast<int64_t>((timestamps[0] & validMask) * period);
+  return true;
+}
+
+void GpuTrace::calibrate(VkQueue queue, VkCommandPool commandPool) {
+  if (!enabled() || calibrateWithExtension()) {
+    return;
+  }
+  // Without the extension, time one timestamp write: it lands somewhere
+  // between submit and the end of the wait, so the offset is off by at most
+  // that latency and does not follow drift.
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+  VkCommandBuffer commandBuffer;
+  if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Fail to allocate the calibration command buffer.";
+    return;
+  }
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  vkCmdResetQueryPool(commandBuffer, queryPool, 0, 1);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      queryPool, 0);
+  vkEndCommandBuffer(commandBuffer);
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  uint64_t submitTime = traceNow();
+  vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+  vkQueueWaitIdle(queue);
+  uint64_t waitTime = traceNow();
+
+  uint64_t timestamp = 0;
+  if (vkGetQueryPoolResults(device, queryPool, 0, 1, sizeof(timestamp),
+                            &timestamp, sizeof(timestamp),
+                            VK_QUERY_RESULT_64_BIT |
+                                VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS) {
+    offset = static_cast<int64_t>(submitTime + (waitTime - submitTime) / 2) -
+             static_cast<int64_t>((timestamp & validMask) * period);
+  }
+  vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+}
+
+void GpuTrace::reset(VkCommandBuffer commandBuffer, uint32_t slot) {
+  if (!enabled()) {
+    return;
+  }
+  vkCmdResetQueryPool(commandBuffer, queryPool, slot * maxRanges * 2,
+                      maxRanges * 2);
+  Slot &s = slots[slot];
+  s.ranges.clear();
+  s.open.clear();
+  s.queries = 0;
+  s.pending = false;
+}
+
+void GpuTrace::begin(VkCommandBuffer commandBuffer, uint32_t slot,
+                     const std::string &name) {
+  if (!enabled()) {
+    return;
+  }
+  Slot &s = slots[slot];
+  if (s.ranges.size() >= maxRanges) {
+    // keep end() balanced for ranges that did not fit
+    s.open.push_back(~0U);
+    return;
+  }
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      queryPool, slot * maxRanges * 2 + s.queries);
+  s.open.push_back(static_cast<uint32_t>(s.ranges.size()));
+  s.ranges.push_back({traceIntern(name), s.queries++, 0});
+}
+
+void GpuTrace::end(VkCommandBuffer commandBuffer, uint32_t slot) {
+  if (!enabled()) {
+    return;
+  }
+  Slot &s = slots[slot];
+  uint32_t range = s.open.back();
+  s.open.pop_back();
+  if (range == ~0U) {
+    return;
+  }
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      queryPool, slot * maxRanges * 2 + s.queries);
+  s.ranges[range].endQuery = s.queries++;
+}
+
+void GpuTrace::submitted(uint32_t slot) {
+  if (enabled()) {
+    slots[slot].pending = true;
+  }
+}
+
+bool GpuTrace::collect(uint32_t slot, double &milliseconds) {
+  if (!enabled() || !slots[slot].pending || slots[slot].queries == 0) {
+    return false;
+  }
+  Slot &s = slots[slot];
+  // value and availability per query
+  if (vkGetQueryPoolResults(device, queryPool, slot * maxRanges * 2,
+                            s.queries, s.queries * 2 * sizeof(uint64_t),
+                            results.data(), 2 * sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT |
+                                VK_QUERY_RESULT_WITH_AVAILABILITY_BIT) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  s.pending = false;
+
+  if (++collectsSinceCalibration >= CALIBRATION_INTERVAL) {
+    collectsSinceCalibration = 0;
+    calibrateWithExtension();
+  }
+  uint64_t first = std::numeric_limits<uint64_t>::max(), last = 0;
+  for (const auto &range : s.ranges) {
+    uint64_t begin = results[range.beginQuery * 2] & validMask;
+    uint64_t end = results[range.endQuery * 2] & validMask;
+    first = std::min(first, begin);
+    last = std::max(last, end);
+    traceGpuEvent(range.name,
+                  static_cast<uint64_t>(static_cast<int64_t>(begin * period) +
+                                        offset),
+                  static_cast<uint64_t>(static_cast<int64_t>(end * period) +
+                                        offset));
+  }
+  milliseconds = last > first ? (last - first) * period / 1e6 : 0.0;
+  return true;
+}
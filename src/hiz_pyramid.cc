@@ -0,0 +1,328 @@
+#include "hiz_pyramid.h"
+#include "logging.h"
+#include "utility.h"
+
+#include <algorithm>
+
+bool HiZPyramid::supported(VkPhysicalDevice physicalDevice) {
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, FORMAT,
+                                      &formatProperties);
+  const VkFormatFeatureFlags pyramidFeatures =
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+  if ((formatProperties.optimalTilingFeatures & pyramidFeatures) !=
+      pyramidFeatures) {
+    return false;
+  }
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, DEPTH_FORMAT,
+                                      &formatProperties);
+  const VkFormatFeatureFlags depthFeatures =
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+      VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  return (formatProperties.optimalTilingFeatures & depthFeatures) ==
+         depthFeatures;
+}
+
+void HiZPyramid::create(VkPhysicalDevice physicalDevice, VkDevice dev,
+                        VkExtent2D extent) {
+  device = dev;
+  depthExtent = extent;
+  levelExtents.clear();
+  VkExtent2D level = {std::max((extent.width + 1) / 2, 1U),
+                      std::max((extent.height + 1) / 2, 1U)};
+  levelExtents.push_back(level);
+  while (level.width > 1 || level.height > 1) {
+    level = {(level.width + 1) / 2, (level.height + 1) / 2};
+    levelExtents.push_back(level);
+  }
+  const uint32_t levels = levelCount();
+
+  VkImageCreateInfo imageInfo = {};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = FORMAT;
+  imageInfo.extent = {levelExtents[0].width, levelExtents[0].height, 1};
+  imageInfo.mipLevels = levels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (vkCreateImage(device, &imageInfo, hostAllocator(),
+                    pyramid.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z pyramid.";
+    return;
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device, pyramid, &requirements);
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  uint32_t memoryType = memoryProperties.memoryTypeCount;
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+    if ((requirements.memoryTypeBits & (1U << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+      memoryType = i;
+      break;
+    }
+  }
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = requirements.size;
+  allocInfo.memoryTypeIndex = memoryType;
+  if (memoryType == memoryProperties.memoryTypeCount ||
+      allocateDeviceMemory(device, &allocInfo, hostAllocator(),
+                           memory.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to allocate Hi-Z pyramid memory.";
+    return;
+  }
+  vkBindImageMemory(device, pyramid, memory, 0);
+
+  VkImageViewCreateInfo viewInfo = {};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = pyramid;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = FORMAT;
+  viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+  if (vkCreateImageView(device, &viewInfo, hostAllocator(),
+                        pyramidView.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z pyramid view.";
+  }
+  levelViews.resize(levels);
+  for (uint32_t i = 0; i < levels; ++i) {
+    viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1};
+    if (vkCreateImageView(device, &viewInfo, hostAllocator(),
+                          levelViews[i].replace(device)) != VK_SUCCESS) {
+      LOG(ERROR) << "Fail to create Hi-Z pyramid level view.";
+    }
+  }
+
+  // texelFetch only, the filter never matters
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = static_cast<float>(levels);
+  if (vkCreateSampler(device, &samplerInfo, hostAllocator(),
+                      nearestSampler.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z sampler.";
+  }
+
+  // 0: source level or depth buffer, 1: destination level
+  VkDescriptorSetLayoutBinding bindings[2] = {};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+  setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setLayoutInfo.bindingCount = 2;
+  setLayoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, hostAllocator(),
+                                  setLayout.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z descriptor set layout.";
+    return;
+  }
+
+  VkDescriptorSetLayout layout = setLayout;
+  VkPushConstantRange pushConstants = {VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                       sizeof(ReduceConstants)};
+  VkPipelineLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &layout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushConstants;
+  if (vkCreatePipelineLayout(device, &layoutInfo, hostAllocator(),
+                             pipelineLayout.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z pipeline layout.";
+    return;
+  }
+
+  auto code = readFile("hiz_reduce.comp.spv");
+  VkShaderModuleCreateInfo moduleInfo = {};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = code.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+  UniqueShaderModule module;
+  if (vkCreateShaderModule(device, &moduleInfo, hostAllocator(),
+                           module.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z shader module.";
+    return;
+  }
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = module;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+  if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+                               hostAllocator(),
+                               reducePipeline.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z reduction pipeline.";
+    return;
+  }
+
+  VkDescriptorPoolSize poolSizes[2] = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, levels},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levels}};
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = levels;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool(device, &poolInfo, hostAllocator(),
+                             descriptorPool.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create Hi-Z descriptor pool.";
+    return;
+  }
+  std::vector<VkDescriptorSetLayout> layouts(levels, layout);
+  levelSets.resize(levels);
+  VkDescriptorSetAllocateInfo setInfo = {};
+  setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setInfo.descriptorPool = descriptorPool;
+  setInfo.descriptorSetCount = levels;
+  setInfo.pSetLayouts = layouts.data();
+  if (vkAllocateDescriptorSets(device, &setInfo, levelSets.data()) !=
+      VK_SUCCESS) {
+    LOG(ERROR) << "Fail to allocate Hi-Z descriptor sets.";
+    levelSets.clear();
+    return;
+  }
+
+  // the source of level 0 is written by setDepth
+  for (uint32_t i = 0; i < levels; ++i) {
+    VkDescriptorImageInfo imageInfos[2] = {};
+    imageInfos[0].sampler = nearestSampler;
+    imageInfos[0].imageView = i > 0 ? levelViews[i - 1].get() : VK_NULL_HANDLE;
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfos[1].imageView = levelViews[i];
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    VkWriteDescriptorSet writes[2] = {};
+    for (uint32_t b = 0; b < 2; ++b) {
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = levelSets[i];
+      writes[b].dstBinding = b;
+      writes[b].descriptorCount = 1;
+      writes[b].descriptorType = bindings[b].descriptorType;
+      writes[b].pImageInfo = &imageInfos[b];
+    }
+    vkUpdateDescriptorSets(device, i > 0 ? 2 : 1, i > 0 ? writes : writes + 1,
+                           0, nullptr);
+  }
+}
+
+void HiZPyramid::destroy() {
+  levelSets.clear();
+  descriptorPool.reset();
+  reducePipeline.reset();
+  pipelineLayout.reset();
+  setLayout.reset();
+  nearestSampler.reset();
+  levelViews.clear();
+  pyramidView.reset();
+  pyramid.reset();
+  memory.reset();
+  levelExtents.clear();
+}
+
+void HiZPyramid::setDepth(VkImageView depthView) {
+  if (levelSets.empty()) {
+    return;
+  }
+  VkDescriptorImageInfo imageInfo = {};
+  imageInfo.sampler = nearestSampler;
+  imageInfo.imageView = depthView;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = levelSets[0];
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void HiZPyramid::recordClear(VkCommandBuffer commandBuffer) {
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = pyramid;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount(), 0,
+                              1};
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  VkClearColorValue farthest = {{0.0f, 1.0f, 0.0f, 0.0f}};
+  vkCmdClearColorImage(commandBuffer, pyramid,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &farthest, 1,
+                       &barrier.subresourceRange);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+}
+
+void HiZPyramid::recordReduce(VkCommandBuffer commandBuffer) {
+  if (levelSets.empty()) {
+    return;
+  }
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    reducePipeline);
+  VkExtent2D source = depthExtent;
+  for (uint32_t i = 0; i < levelCount(); ++i) {
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipelineLayout, 0, 1, &levelSets[i], 0, nullptr);
+    ReduceConstants constants = {{static_cast<int32_t>(source.width),
+                                  static_cast<int32_t>(source.height)},
+                                 i == 0 ? 1U : 0U};
+    vkCmdPushConstants(commandBuffer, pipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                       &constants);
+    const VkExtent2D &level = levelExtents[i];
+    vkCmdDispatch(commandBuffer, (level.width + GROUP_SIZE - 1) / GROUP_SIZE,
+                  (level.height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+    source = level;
+
+    if (i + 1 == levelCount()) {
+      break;
+    }
+    // the next level reads this one
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = pyramid;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+  }
+}
@@ -0,0 +1,336 @@
+#include "host_allocator.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace {
+
+// per-thread arena blocks; command allocations above a quarter of a block go
+// to malloc so one large request cannot waste most of a block
+const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+const size_t ARENA_MAX_ALLOCATION = ARENA_BLOCK_SIZE / 4;
+
+// pool slots are 32 << class bytes, carved from slabs of POOL_SLAB_SIZE
+const uint32_t POOL_CLASSES = 8;
+const size_t POOL_MIN_SLOT = 32;
+const size_t POOL_SLAB_SIZE = 64 * 1024;
+
+enum Source : uint8_t { SOURCE_SYSTEM, SOURCE_ARENA, SOURCE_POOL };
+
+struct ArenaBlock {
+  // one reference per live allocation plus one while a thread bumps from it
+  std::atomic<uint32_t> references;
+  size_t offset;
+};
+
+// stored right before every pointer handed to the driver
+struct Header {
+  void *raw;
+  ArenaBlock *block;
+  size_t size;
+  uint32_t alignment;
+  uint8_t scope;
+  uint8_t source;
+  uint8_t sizeClass;
+};
+
+struct ScopeCounters {
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> frees;
+  std::atomic<uint64_t> liveAllocations;
+  std::atomic<uint64_t> liveBytes;
+  std::atomic<uint64_t> peakBytes;
+  std::atomic<uint64_t> internalBytes;
+};
+
+ScopeCounters counters[HOST_ALLOCATION_SCOPES];
+std::atomic<uint64_t> arenaBytes(0);
+std::atomic<uint64_t> poolBytes(0);
+
+// bytes a backend must provide so `size` fits behind a header at `alignment`
+inline size_t rawSize(size_t size, size_t alignment) {
+  return size + sizeof(Header) + alignment - 1;
+}
+
+inline char *alignUser(char *raw, size_t alignment) {
+  uintptr_t p = reinterpret_cast<uintptr_t>(raw) + sizeof(Header);
+  p = (p + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+  return reinterpret_cast<char *>(p);
+}
+
+inline Header *headerOf(void *user) {
+  return reinterpret_cast<Header *>(static_cast<char *>(user) -
+                                    sizeof(Header));
+}
+
+void releaseBlock(ArenaBlock *block) {
+  if (--block->references == 0) {
+    block->~ArenaBlock();
+    std::free(block);
+    arenaBytes -= ARENA_BLOCK_SIZE;
+  }
+}
+
+// The calling thread's current block. Blocks may be freed into from other
+// threads, so the last reference, not the owner, returns them to the system.
+struct ThreadArena {
+  ArenaBlock *block = nullptr;
+
+  ~ThreadArena() {
+    if (block != nullptr) {
+      releaseBlock(block);
+    }
+  }
+
+  char *allocate(size_t bytes, ArenaBlock *&owner) {
+    const size_t dataOffset = sizeof(ArenaBlock);
+    if (block != nullptr && block->references == 1) {
+      // nothing handed out is still live, and only this thread adds
+      // references, so the block can be rewound
+      block->offset = dataOffset;
+    }
+    if (block == nullptr || block->offset + bytes > ARENA_BLOCK_SIZE) {
+      if (block != nullptr) {
+        releaseBlock(block);
+      }
+      void *memory = std::malloc(ARENA_BLOCK_SIZE);
+      if (memory == nullptr) {
+        block = nullptr;
+        return nullptr;
+      }
+      block = new (memory) ArenaBlock;
+      block->references = 1;
+      block->offset = dataOffset;
+      arenaBytes += ARENA_BLOCK_SIZE;
+    }
+    char *raw = reinterpret_cast<char *>(block) + block->offset;
+    block->offset += bytes;
+    ++block->references;
+    owner = block;
+    return raw;
+  }
+};
+
+thread_local ThreadArena threadArena;
+
+class SizeClassPool {
+public:
+  ~SizeClassPool() {
+    for (void *slab : slabs) {
+      std::free(slab);
+    }
+  }
+
+  void *allocate(size_t slotSize) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeList == nullptr) {
+      char *slab = static_cast<char *>(std::malloc(POOL_SLAB_SIZE));
+      if (slab == nullptr) {
+        return nullptr;
+      }
+      slabs.push_back(slab);
+      poolBytes += POOL_SLAB_SIZE;
+      for (size_t offset = 0; offset + slotSize <= POOL_SLAB_SIZE;
+           offset += slotSize) {
+        push(slab + offset);
+      }
+    }
+    void *slot = freeList;
+    freeList = *static_cast<void **>(slot);
+    return slot;
+  }
+
+  void free(void *slot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    push(slot);
+  }
+
+private:
+  void push(void *slot) {
+    *static_cast<void **>(slot) = freeList;
+    freeList = slot;
+  }
+
+  std::mutex mutex;
+  void *freeList = nullptr;
+  std::vector<void *> slabs;
+};
+
+SizeClassPool pools[POOL_CLASSES];
+
+void recordAllocation(VkSystemAllocationScope scope, size_t size) {
+  ScopeCounters &c = counters[scope];
+  ++c.allocations;
+  ++c.liveAllocations;
+  uint64_t live = c.liveBytes += size;
+  uint64_t peak = c.peakBytes;
+  while (live > peak && !c.peakBytes.compare_exchange_weak(peak, live)) {
+  }
+}
+
+void recordFree(VkSystemAllocationScope scope, size_t size) {
+  ScopeCounters &c = counters[scope];
+  ++c.frees;
+  --c.liveAllocations;
+  c.liveBytes -= size;
+}
+
+void *VKAPI_PTR allocateHost(void *, size_t size, size_t alignment,
+                         VkSystemAllocationScope scope) {
+  if (size == 0) {
+    return nullptr;
+  }
+  alignment = std::max(alignment, alignof(Header));
+  size_t bytes = rawSize(size, alignment);
+
+  char *raw = nullptr;
+  ArenaBlock *block = nullptr;
+  uint8_t source = SOURCE_SYSTEM;
+  uint8_t sizeClass = 0;
+  if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND &&
+      bytes <= ARENA_MAX_ALLOCATION) {
+    raw = threadArena.allocate(bytes, block);
+    source = SOURCE_ARENA;
+  } else {
+    size_t slotSize = POOL_MIN_SLOT;
+    while (slotSize < bytes && sizeClass < POOL_CLASSES) {
+      slotSize <<= 1;
+      ++sizeClass;
+    }
+    if (sizeClass < POOL_CLASSES) {
+      raw = static_cast<char *>(pools[sizeClass].allocate(slotSize));
+      source = SOURCE_POOL;
+    }
+  }
+  if (raw == nullptr && source != SOURCE_SYSTEM) {
+    return nullptr;
+  }
+  if (source == SOURCE_SYSTEM) {
+    raw = static_cast<char *>(std::malloc(bytes));
+    if (raw == nullptr) {
+      return nullptr;
+    }
+  }
+
+  char *user = alignUser(raw, alignment);
+  Header *header = headerOf(user);
+  header->raw = raw;
+  header->block = block;
+  header->size = size;
+  header->alignment = static_cast<uint32_t>(alignment);
+  header->scope = static_cast<uint8_t>(scope);
+  header->source = source;
+  header->sizeClass = sizeClass;
+  recordAllocation(scope, size);
+  return user;
+}
+
+void VKAPI_PTR freeHost(void *, void *memory) {
+  if (memory == nullptr) {
+    return;
+  }
+  Header header = *headerOf(memory);
+  recordFree(static_cast<VkSystemAllocationScope>(header.scope), header.size);
+  switch (header.source) {
+  case SOURCE_ARENA:
+    releaseBlock(header.block);
+    break;
+  case SOURCE_POOL:
+    pools[header.sizeClass].free(header.raw);
+    break;
+  default:
+    std::free(header.raw);
+    break;
+  }
+}
+
+void *VKAPI_PTR reallocateHost(void *userData, void *original, size_t size,
+                           size_t alignment, VkSystemAllocationScope scope) {
+  if (original == nullptr) {
+    return allocateHost(userData, size, alignment, scope);
+  }
+  if (size == 0) {
+    freeHost(userData, original);
+    return nullptr;
+  }
+  const Header *header = headerOf(original);
+  if (size <= header->size && alignment <= header->alignment &&
+      header->scope == scope) {
+    return original;
+  }
+  void *memory = allocateHost(userData, size, alignment, scope);
+  if (memory == nullptr) {
+    // the original allocation stays valid on failure
+    return nullptr;
+  }
+  std::memcpy(memory, original, std::min(size, header->size));
+  freeHost(userData, original);
+  return memory;
+}
+
+void VKAPI_PTR internalAllocation(void *, size_t size,
+                                  VkInternalAllocationType,
+                                  VkSystemAllocationScope scope) {
+  counters[scope].internalBytes += size;
+}
+
+void VKAPI_PTR internalFree(void *, size_t size, VkInternalAllocationType,
+                            VkSystemAllocationScope scope) {
+  counters[scope].internalBytes -= size;
+}
+
+const VkAllocationCallbacks callbacks = {
+    nullptr,        allocateHost,       reallocateHost,
+    freeHost,       internalAllocation, internalFree};
+
+const char *const scopeNames[HOST_ALLOCATION_SCOPES] = {
+    "command", "object", "cache", "device", "instance"};
+
+} // namespace
+
+const VkAllocationCallbacks *hostAllocator() {
+#ifdef MYVK_SYSTEM_HOST_ALLOCATOR
+  return nullptr;
+#else
+  return &callbacks;
+#endif
+}
+
+HostAllocatorStats hostAllocatorStats() {
+  HostAllocatorStats stats = {};
+  for (uint32_t i = 0; i < HOST_ALLOCATION_SCOPES; ++i) {
+    stats.scopes[i].allocations = counters[i].allocations;
+    stats.scopes[i].frees = counters[i].frees;
+    stats.scopes[i].liveAllocations = counters[i].liveAllocations;
+    stats.scopes[i].liveBytes = counters[i].liveBytes;
+    stats.scopes[i].peakBytes = counters[i].peakBytes;
+    stats.scopes[i].internalBytes = counters[i].internalBytes;
+  }
+  stats.arenaBytes = arenaBytes;
+  stats.poolBytes = poolBytes;
+  return stats;
+}
+
+void logHostAllocatorStats() {
+  HostAllocatorStats stats = hostAllocatorStats();
+  for (uint32_t i = 0; i < HOST_ALLOCATION_SCOPES; ++i) {
+    const HostAllocationScopeStats &s = stats.scopes[i];
+    LOG(INFO) << "Host allocations (" << scopeNames[i]
+              << "): " << s.allocations << " allocated, " << s.frees
+              << " freed, peak " << s.peakBytes << " bytes, internal "
+              << s.internalBytes << " bytes";
+    if (s.liveAllocations != 0) {
+      LOG(WARNING) << "Host allocations (" << scopeNames[i]
+                   << "): " << s.liveAllocations << " still live, "
+                   << s.liveBytes << " bytes";
+    }
+  }
+  LOG(INFO) << "Host allocator reserved " << stats.arenaBytes
+            << " arena bytes, " << stats.poolBytes << " pool bytes";
+}
@@ -0,0 +1,119 @@
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <string>
+
+namespace {
+
+// the job system whose worker the calling thread is, and its queue
+thread_local const JobSystem *currentSystem = nullptr;
+thread_local uint32_t currentQueue = 0;
+
+} // namespace
+
+JobSystem::JobSystem(uint32_t workerCount) : queued(0), stopping(false) {
+  for (uint32_t i = 0; i <= workerCount; ++i) {
+    queues.emplace_back(new Queue());
+  }
+  workers.reserve(workerCount);
+  for (uint32_t i = 0; i < workerCount; ++i) {
+    workers.emplace_back(&JobSystem::workerLoop, this, i);
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  // without workers the jobs still run, on this thread
+  while (runOne(ownQueue())) {
+  }
+}
+
+void JobSystem::run(Counter &counter, Job job) {
+  counter.pending.fetch_add(1, std::memory_order_relaxed);
+  {
+    Queue &queue = *queues[ownQueue()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back({std::move(job), &counter});
+  }
+  queued.fetch_add(1);
+  // a worker checks `queued` under sleepMutex before sleeping, so taking it
+  // here means the wake up cannot be lost
+  { std::lock_guard<std::mutex> lock(sleepMutex); }
+  wake.notify_one();
+}
+
+void JobSystem::wait(const Counter &counter) {
+  const uint32_t own = ownQueue();
+  while (!counter.done()) {
+    if (!runOne(own)) {
+      // the remaining jobs of the group are running elsewhere
+      std::this_thread::yield();
+    }
+  }
+}
+
+uint32_t JobSystem::ownQueue() const {
+  return currentSystem == this ? currentQueue
+                               : static_cast<uint32_t>(queues.size() - 1);
+}
+
+bool JobSystem::runOne(uint32_t own) {
+  Task task;
+  bool found = false;
+  {
+    Queue &queue = *queues[own];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      found = true;
+    }
+  }
+  const uint32_t queueCount = static_cast<uint32_t>(queues.size());
+  for (uint32_t i = 1; !found && i < queueCount; ++i) {
+    Queue &queue = *queues[(own + i) % queueCount];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+  queued.fetch_sub(1);
+  task.job();
+  task.counter->pending.fetch_sub(1, std::memory_order_release);
+  return true;
+}
+
+void JobSystem::workerLoop(uint32_t index) {
+  currentSystem = this;
+  currentQueue = index;
+  traceThreadName("job worker " + std::to_string(index));
+  while (true) {
+    if (runOne(index)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+    if (stopping && queued.load() == 0) {
+      return;
+    }
+  }
+}
+
+JobSystem &jobSystem() {
+  static JobSystem system(
+      std::max(1U, std::thread::hardware_concurrency()) - 1);
+  return system;
+}
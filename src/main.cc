@@ -1,13 +1,37 @@
 #include "application.h"
 #include "logging.h"
 
+#include <cstdlib>
+#include <cstring>
+
 int main(int argc, char *argv[]) {
   // Initialize Google’s logging library.
   initLogging(argv[0]);
 
   LOG(INFO) << "Application starting..";
 
-  Application application;
+  // --batch [jobs] [MiB per job] runs the headless compute batch instead
+  if (argc > 1 && std::strcmp(argv[1], "--batch") == 0) {
+    unsigned long jobCount = 64;
+    unsigned long megabytes = 16;
+    if (argc > 2) {
+      jobCount = std::strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3) {
+      megabytes = std::strtoul(argv[3], nullptr, 10);
+    }
+    Application application;
+    try {
+      application.runBatch(static_cast<uint32_t>(jobCount),
+                           static_cast<VkDeviceSize>(megabytes) << 20);
+    } catch (const std::runtime_error &e) {
+      LOG(ERROR) << e.what();
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  Application application(argc > 1 ? argv[1] : "");
   try {
     application.run();
   } catch (const std::runtime_error &e) {
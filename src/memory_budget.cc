@@ -0,0 +1,125 @@
+#include "memory_budget.h"
+#include "logging.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+uint32_t memoryTypeHeaps[VK_MAX_MEMORY_TYPES] = {};
+std::atomic<VkDeviceSize> heapAllocated[VK_MAX_MEMORY_HEAPS];
+
+// size and heap of every live allocation, so frees can be attributed
+std::mutex allocationsMutex;
+std::unordered_map<VkDeviceMemory, std::pair<uint32_t, VkDeviceSize>>
+    allocations;
+
+} // namespace
+
+VkResult VKAPI_PTR
+allocateDeviceMemory(VkDevice device, const VkMemoryAllocateInfo *allocateInfo,
+                     const VkAllocationCallbacks *allocator,
+                     VkDeviceMemory *memory) {
+  VkResult result = vkAllocateMemory(device, allocateInfo, allocator, memory);
+  if (result == VK_SUCCESS) {
+    uint32_t heap = memoryTypeHeaps[allocateInfo->memoryTypeIndex];
+    heapAllocated[heap] += allocateInfo->allocationSize;
+    std::lock_guard<std::mutex> lock(allocationsMutex);
+    allocations[*memory] = std::make_pair(heap, allocateInfo->allocationSize);
+  }
+  return result;
+}
+
+void VKAPI_PTR freeDeviceMemory(VkDevice device, VkDeviceMemory memory,
+                                const VkAllocationCallbacks *allocator) {
+  if (memory != VK_NULL_HANDLE) {
+    std::lock_guard<std::mutex> lock(allocationsMutex);
+    auto it = allocations.find(memory);
+    if (it != allocations.end()) {
+      heapAllocated[it->second.first] -= it->second.second;
+      allocations.erase(it);
+    }
+  }
+  vkFreeMemory(device, memory, allocator);
+}
+
+void MemoryBudget::create(VkInstance instance, VkPhysicalDevice dev,
+                          bool budgetExtension) {
+  physicalDevice = dev;
+  getMemoryProperties2 = nullptr;
+  if (budgetExtension) {
+    getMemoryProperties2 =
+        (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+            instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+    if (getMemoryProperties2 == nullptr) {
+      LOG(WARNING) << "Memory budget: falling back to heap sizes.";
+    }
+  }
+
+  VkPhysicalDeviceMemoryProperties properties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &properties);
+  for (uint32_t i = 0; i < properties.memoryTypeCount; ++i) {
+    memoryTypeHeaps[i] = properties.memoryTypes[i].heapIndex;
+  }
+  heaps.assign(properties.memoryHeapCount, MemoryHeapBudget());
+  cooldown.assign(properties.memoryHeapCount, 0);
+  for (uint32_t i = 0; i < properties.memoryHeapCount; ++i) {
+    heaps[i].size = properties.memoryHeaps[i].size;
+    heaps[i].deviceLocal = (properties.memoryHeaps[i].flags &
+                            VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+  }
+  sample();
+}
+
+void MemoryBudget::addEvictCallback(EvictCallback callback) {
+  evictCallbacks.push_back(std::move(callback));
+}
+
+void MemoryBudget::sample() {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+  if (getMemoryProperties2 != nullptr) {
+    budgetProperties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    VkPhysicalDeviceMemoryProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    properties.pNext = &budgetProperties;
+    getMemoryProperties2(physicalDevice, &properties);
+  }
+
+  for (uint32_t i = 0; i < heapCount(); ++i) {
+    MemoryHeapBudget &heap = heaps[i];
+    heap.allocated = heapAllocated[i];
+    if (getMemoryProperties2 != nullptr) {
+      heap.budget = budgetProperties.heapBudget[i];
+      heap.usage = budgetProperties.heapUsage[i];
+    } else {
+      heap.budget = heap.size;
+      heap.usage = heap.allocated;
+    }
+
+    if (cooldown[i] > 0) {
+      --cooldown[i];
+      continue;
+    }
+    if (heap.usage <= static_cast<VkDeviceSize>(heap.budget * PRESSURE)) {
+      continue;
+    }
+    VkDeviceSize wanted =
+        heap.usage - static_cast<VkDeviceSize>(heap.budget * TARGET);
+    VkDeviceSize released = 0;
+    for (auto &evict : evictCallbacks) {
+      if (released >= wanted) {
+        break;
+      }
+      released += evict(i, wanted - released);
+    }
+    cooldown[i] = EVICTION_COOLDOWN;
+    if (released < wanted) {
+      LOG(WARNING) << "Memory heap " << i << " over budget: " << heap.usage
+                   << " of " << heap.budget << " bytes used, " << released
+                   << " of " << wanted << " bytes evicted";
+    }
+  }
+}
@@ -0,0 +1,240 @@
+#include "mesh.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifndef __WIN32__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// whether `length` bytes at `offset` lie within `size` bytes, without
+// wrapping, and the offset suits the section's element type
+bool sectionValid(uint64_t offset, uint64_t length, uint64_t alignment,
+                  uint64_t size) {
+  return offset % alignment == 0 && offset <= size && length <= size - offset;
+}
+
+} // namespace
+
+uint16_t floatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mantissa = bits & 0x7FFFFF;
+
+  if (((bits >> 23) & 0xFF) == 0xFF) {
+    // inf or nan
+    return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+  }
+  if (exponent >= 31) {
+    return static_cast<uint16_t>(sign | 0x7C00);
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    // subnormal half
+    mantissa |= 0x800000;
+    uint32_t shift = static_cast<uint32_t>(14 - exponent);
+    uint32_t half = mantissa >> shift;
+    if ((mantissa >> (shift - 1)) & 1) {
+      ++half;
+    }
+    return static_cast<uint16_t>(sign | half);
+  }
+  uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) |
+                  (mantissa >> 13);
+  // round to nearest, a carry into the exponent is still correct
+  if (mantissa & 0x1000) {
+    ++half;
+  }
+  return static_cast<uint16_t>(half);
+}
+
+std::vector<PackedVertex>
+quantizeVertices(const std::vector<MeshVertex> &vertices, MeshHeader &header) {
+  for (int axis = 0; axis < 3; ++axis) {
+    header.boundsMin[axis] =
+        vertices.empty() ? 0.0f : vertices[0].position[axis];
+    header.boundsMax[axis] = header.boundsMin[axis];
+  }
+  for (const auto &vertex : vertices) {
+    for (int axis = 0; axis < 3; ++axis) {
+      header.boundsMin[axis] =
+          std::min(header.boundsMin[axis], vertex.position[axis]);
+      header.boundsMax[axis] =
+          std::max(header.boundsMax[axis], vertex.position[axis]);
+    }
+  }
+
+  std::vector<PackedVertex> packed(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    const MeshVertex &v = vertices[i];
+    PackedVertex &p = packed[i];
+    for (int axis = 0; axis < 3; ++axis) {
+      float extent = header.boundsMax[axis] - header.boundsMin[axis];
+      float t = extent > 0.0f
+                    ? (v.position[axis] - header.boundsMin[axis]) / extent
+                    : 0.0f;
+      p.position[axis] = static_cast<uint16_t>(std::lround(t * 65535.0f));
+      float n = std::max(-1.0f, std::min(1.0f, v.normal[axis]));
+      p.normal[axis] = static_cast<int8_t>(std::lround(n * 127.0f));
+    }
+    p.position[3] = 65535;
+    p.normal[3] = 0;
+    p.uv[0] = floatToHalf(v.uv[0]);
+    p.uv[1] = floatToHalf(v.uv[1]);
+  }
+  return packed;
+}
+
+void writeMesh(const std::string &filename,
+               const std::vector<PackedVertex> &vertices,
+               const std::vector<uint32_t> &indices,
+               const std::vector<MeshLod> &lods,
+               const std::vector<Meshlet> &meshlets, MeshHeader header) {
+  std::memcpy(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC));
+  header.version = MESH_VERSION;
+  header.vertexCount = static_cast<uint32_t>(vertices.size());
+  header.indexCount = static_cast<uint32_t>(indices.size());
+  header.vertexStride = sizeof(PackedVertex);
+  header.indexSize = vertices.size() <= 0x10000 ? 2 : 4;
+  header.lodCount = static_cast<uint32_t>(lods.size());
+  header.meshletCount = static_cast<uint32_t>(meshlets.size());
+  header.vertexOffset = alignUp(sizeof(MeshHeader), MESH_SECTION_ALIGNMENT);
+  header.indexOffset =
+      alignUp(header.vertexOffset + vertices.size() * sizeof(PackedVertex),
+              MESH_SECTION_ALIGNMENT);
+  header.lodOffset =
+      alignUp(header.indexOffset + indices.size() * header.indexSize,
+              MESH_SECTION_ALIGNMENT);
+  header.meshletOffset =
+      alignUp(header.lodOffset + lods.size() * sizeof(MeshLod),
+              MESH_SECTION_ALIGNMENT);
+
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    throw std::runtime_error("IO: Failed to open file!");
+  }
+  // writes `bytes` and pads the file up to `next`
+  const char padding[MESH_SECTION_ALIGNMENT] = {};
+  uint64_t written = 0;
+  auto writeSection = [&](const void *bytes, uint64_t count, uint64_t next) {
+    file.write(static_cast<const char *>(bytes),
+               static_cast<std::streamsize>(count));
+    written += count;
+    file.write(padding, static_cast<std::streamsize>(next - written));
+    written = next;
+  };
+
+  writeSection(&header, sizeof(header), header.vertexOffset);
+  writeSection(vertices.data(), vertices.size() * sizeof(PackedVertex),
+               header.indexOffset);
+  if (header.indexSize == 2) {
+    std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+    writeSection(shortIndices.data(), shortIndices.size() * 2,
+                 header.lodOffset);
+  } else {
+    writeSection(indices.data(), indices.size() * 4, header.lodOffset);
+  }
+  writeSection(lods.data(), lods.size() * sizeof(MeshLod),
+               header.meshletOffset);
+  writeSection(meshlets.data(), meshlets.size() * sizeof(Meshlet),
+               header.meshletOffset + meshlets.size() * sizeof(Meshlet));
+  if (!file) {
+    throw std::runtime_error("IO: Failed to write mesh!");
+  }
+}
+
+MappedMesh::MappedMesh(const std::string &filename) {
+#ifdef __WIN32__
+  buffer = readFile(filename);
+  if (buffer.size() < sizeof(MeshHeader)) {
+    throw std::runtime_error("IO: Invalid mesh file!");
+  }
+  data = buffer.data();
+  size = buffer.size();
+#else
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("IO: Failed to open file!");
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 ||
+      st.st_size < static_cast<off_t>(sizeof(MeshHeader))) {
+    ::close(fd);
+    throw std::runtime_error("IO: Invalid mesh file!");
+  }
+  size = static_cast<size_t>(st.st_size);
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error("IO: Failed to map file!");
+  }
+  // the whole file is streamed into the staging buffer right away
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  madvise(mapping, size, MADV_WILLNEED);
+  data = static_cast<const char *>(mapping);
+#endif
+
+  const MeshHeader &h = header();
+  if (std::memcmp(h.magic, MESH_MAGIC, sizeof(MESH_MAGIC)) != 0 ||
+      h.version != MESH_VERSION || h.vertexStride != sizeof(PackedVertex) ||
+      (h.indexSize != 2 && h.indexSize != 4) ||
+      h.lodCount > MESH_MAX_LODS ||
+      !sectionValid(h.vertexOffset, vertexDataSize(), alignof(PackedVertex),
+                    size) ||
+      !sectionValid(h.indexOffset, indexDataSize(), h.indexSize, size) ||
+      !sectionValid(h.lodOffset, h.lodCount * sizeof(MeshLod),
+                    alignof(MeshLod), size) ||
+      !sectionValid(h.meshletOffset, meshletDataSize(), alignof(Meshlet),
+                    size)) {
+#ifndef __WIN32__
+    munmap(const_cast<char *>(data), size);
+#endif
+    data = nullptr;
+    throw std::runtime_error("IO: Invalid mesh file!");
+  }
+  // the ranges end up in indirect draws, so they must stay in bounds
+  bool rangesValid = true;
+  for (uint32_t i = 0; i < h.lodCount; ++i) {
+    const MeshLod &lod = lods()[i];
+    rangesValid &= lod.firstMeshlet <= h.meshletCount &&
+                   lod.meshletCount <= h.meshletCount - lod.firstMeshlet;
+  }
+  for (uint32_t i = 0; i < h.meshletCount; ++i) {
+    const Meshlet &meshlet = meshlets()[i];
+    rangesValid &= meshlet.firstIndex <= h.indexCount &&
+                   meshlet.indexCount <= h.indexCount - meshlet.firstIndex;
+  }
+  if (!rangesValid) {
+#ifndef __WIN32__
+    munmap(const_cast<char *>(data), size);
+#endif
+    data = nullptr;
+    throw std::runtime_error("IO: Invalid mesh file!");
+  }
+}
+
+MappedMesh::~MappedMesh() {
+#ifndef __WIN32__
+  if (data != nullptr) {
+    munmap(const_cast<char *>(data), size);
+  }
+#endif
+}
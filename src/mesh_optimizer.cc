@@ -0,0 +1,295 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace {
+
+// tuning values from Forsyth's "Linear-Speed Vertex Cache Optimisation"
+const int CACHE_SIZE = 32;
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRIANGLE_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+
+float vertexScore(int cachePosition, uint32_t remainingTriangles) {
+  if (remainingTriangles == 0) {
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      // the vertices of the last triangle get a fixed score so that strips
+      // are not preferred over fans
+      score = LAST_TRIANGLE_SCORE;
+    } else {
+      float scaler = 1.0f / (CACHE_SIZE - 3);
+      score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+    }
+  }
+  // favour vertices with few triangles left so they are finished off
+  score += VALENCE_BOOST_SCALE *
+           std::pow(static_cast<float>(remainingTriangles),
+                    -VALENCE_BOOST_POWER);
+  return score;
+}
+
+} // namespace
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount) {
+  const size_t triangleCount = indices.size() / 3;
+  if (triangleCount == 0) {
+    return;
+  }
+
+  // triangles adjacent to each vertex, the live ones first
+  std::vector<uint32_t> remaining(vertexCount, 0);
+  for (uint32_t index : indices) {
+    ++remaining[index];
+  }
+  std::vector<uint32_t> offsets(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> vertexScores(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    vertexScores[v] = vertexScore(-1, remaining[v]);
+  }
+  std::vector<float> triangleScores(triangleCount);
+  std::vector<bool> emitted(triangleCount, false);
+  for (size_t t = 0; t < triangleCount; ++t) {
+    triangleScores[t] = vertexScores[indices[t * 3]] +
+                        vertexScores[indices[t * 3 + 1]] +
+                        vertexScores[indices[t * 3 + 2]];
+  }
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  std::vector<uint32_t> cache, newCache;
+  cache.reserve(CACHE_SIZE + 3);
+  newCache.reserve(CACHE_SIZE + 3);
+
+  long best = 0;
+  for (size_t t = 1; t < triangleCount; ++t) {
+    if (triangleScores[t] > triangleScores[best]) {
+      best = static_cast<long>(t);
+    }
+  }
+  size_t scanCursor = 0;
+
+  while (result.size() < indices.size()) {
+    if (best < 0) {
+      // dead end: no triangle touches the cache, take the next unemitted
+      while (emitted[scanCursor]) {
+        ++scanCursor;
+      }
+      best = static_cast<long>(scanCursor);
+    }
+
+    const uint32_t *triangle = &indices[best * 3];
+    emitted[best] = true;
+    result.insert(result.end(), triangle, triangle + 3);
+
+    for (int k = 0; k < 3; ++k) {
+      uint32_t v = triangle[k];
+      uint32_t begin = offsets[v];
+      uint32_t end = begin + remaining[v];
+      for (uint32_t a = begin; a < end; ++a) {
+        if (adjacency[a] == static_cast<uint32_t>(best)) {
+          adjacency[a] = adjacency[end - 1];
+          break;
+        }
+      }
+      --remaining[v];
+    }
+
+    // the emitted triangle goes to the front of the LRU cache
+    newCache.assign(triangle, triangle + 3);
+    for (uint32_t v : cache) {
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        newCache.push_back(v);
+      }
+    }
+    for (uint32_t v : cache) {
+      cachePosition[v] = -1;
+    }
+    for (size_t i = 0; i < newCache.size(); ++i) {
+      uint32_t v = newCache[i];
+      cachePosition[v] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+      vertexScores[v] = vertexScore(cachePosition[v], remaining[v]);
+    }
+    // vertices that fell out of the cache have a new score as well
+    for (uint32_t v : cache) {
+      if (cachePosition[v] < 0) {
+        vertexScores[v] = vertexScore(-1, remaining[v]);
+      }
+    }
+
+    best = -1;
+    float bestScore = -1.0f;
+    for (uint32_t v : newCache) {
+      for (uint32_t a = offsets[v]; a < offsets[v] + remaining[v]; ++a) {
+        uint32_t t = adjacency[a];
+        float score = vertexScores[indices[t * 3]] +
+                      vertexScores[indices[t * 3 + 1]] +
+                      vertexScores[indices[t * 3 + 2]];
+        triangleScores[t] = score;
+        if (score > bestScore) {
+          bestScore = score;
+          best = static_cast<long>(t);
+        }
+      }
+    }
+
+    if (newCache.size() > CACHE_SIZE) {
+      newCache.resize(CACHE_SIZE);
+    }
+    cache.swap(newCache);
+  }
+
+  indices.swap(result);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t> &indices,
+                                          size_t vertexCount) {
+  std::vector<uint32_t> remap(vertexCount, ~0U);
+  uint32_t next = 0;
+  for (auto &index : indices) {
+    if (remap[index] == ~0U) {
+      remap[index] = next++;
+    }
+    index = remap[index];
+  }
+  return remap;
+}
+
+std::vector<uint32_t> simplifyClustered(const std::vector<uint32_t> &indices,
+                                        const std::vector<float> &positions,
+                                        uint32_t gridSize, float &error) {
+  error = 0.0f;
+  const size_t vertexCount = positions.size() / 3;
+  std::vector<bool> referenced(vertexCount, false);
+  for (uint32_t index : indices) {
+    referenced[index] = true;
+  }
+
+  float boundsMin[3] = {0.0f, 0.0f, 0.0f}, boundsMax[3] = {0.0f, 0.0f, 0.0f};
+  bool first = true;
+  for (size_t v = 0; v < vertexCount; ++v) {
+    if (!referenced[v]) {
+      continue;
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+      float p = positions[v * 3 + axis];
+      boundsMin[axis] = first ? p : std::min(boundsMin[axis], p);
+      boundsMax[axis] = first ? p : std::max(boundsMax[axis], p);
+    }
+    first = false;
+  }
+  float longest = std::max(boundsMax[0] - boundsMin[0],
+                           std::max(boundsMax[1] - boundsMin[1],
+                                    boundsMax[2] - boundsMin[2]));
+  if (first || longest <= 0.0f || gridSize == 0) {
+    return indices;
+  }
+  const float cellSize = longest / static_cast<float>(gridSize);
+
+  // cell of each vertex, packed into 21 bits per axis
+  std::vector<uint64_t> cellOf(vertexCount, 0);
+  struct Cell {
+    float sum[3];
+    uint32_t count;
+    uint32_t representative;
+    float bestDistance;
+  };
+  std::unordered_map<uint64_t, Cell> cells;
+  for (size_t v = 0; v < vertexCount; ++v) {
+    if (!referenced[v]) {
+      continue;
+    }
+    uint64_t key = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+      float t = (positions[v * 3 + axis] - boundsMin[axis]) / cellSize;
+      uint64_t c = std::min(static_cast<uint64_t>(t),
+                            static_cast<uint64_t>(gridSize - 1));
+      key |= c << (axis * 21);
+    }
+    cellOf[v] = key;
+    Cell &cell = cells[key];
+    for (int axis = 0; axis < 3; ++axis) {
+      cell.sum[axis] += positions[v * 3 + axis];
+    }
+    ++cell.count;
+    cell.bestDistance = -1.0f;
+  }
+
+  for (size_t v = 0; v < vertexCount; ++v) {
+    if (!referenced[v]) {
+      continue;
+    }
+    Cell &cell = cells[cellOf[v]];
+    float distance = 0.0f;
+    for (int axis = 0; axis < 3; ++axis) {
+      float d = positions[v * 3 + axis] - cell.sum[axis] / cell.count;
+      distance += d * d;
+    }
+    if (cell.bestDistance < 0.0f || distance < cell.bestDistance) {
+      cell.bestDistance = distance;
+      cell.representative = static_cast<uint32_t>(v);
+    }
+  }
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    uint32_t a = cells[cellOf[indices[i]]].representative;
+    uint32_t b = cells[cellOf[indices[i + 1]]].representative;
+    uint32_t c = cells[cellOf[indices[i + 2]]].representative;
+    if (a != b && b != c && c != a) {
+      result.insert(result.end(), {a, b, c});
+    }
+  }
+
+  for (size_t v = 0; v < vertexCount; ++v) {
+    if (!referenced[v]) {
+      continue;
+    }
+    uint32_t r = cells[cellOf[v]].representative;
+    float distance = 0.0f;
+    for (int axis = 0; axis < 3; ++axis) {
+      float d = positions[v * 3 + axis] - positions[r * 3 + axis];
+      distance += d * d;
+    }
+    error = std::max(error, std::sqrt(distance));
+  }
+  return result;
+}
+
+float computeAcmr(const std::vector<uint32_t> &indices, size_t vertexCount,
+                  uint32_t cacheSize) {
+  if (indices.size() < 3) {
+    return 0.0f;
+  }
+  // a vertex is cached while fewer than cacheSize misses happened since it
+  // was loaded, which is exactly a FIFO of that size
+  std::vector<uint32_t> loadedAt(vertexCount, 0);
+  uint32_t misses = 0;
+  uint32_t time = cacheSize + 1;
+  for (uint32_t index : indices) {
+    if (time - loadedAt[index] > cacheSize) {
+      loadedAt[index] = time++;
+      ++misses;
+    }
+  }
+  return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
@@ -0,0 +1,133 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// cones wider than this (the dot between the axis and the worst normal)
+// are treated as two sided
+const float MIN_CONE_SPREAD = 0.1f;
+
+void normalize(float v[3]) {
+  float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (length > 0.0f) {
+    v[0] /= length;
+    v[1] /= length;
+    v[2] /= length;
+  }
+}
+
+} // namespace
+
+std::vector<Meshlet> buildMeshlets(const std::vector<uint32_t> &indices,
+                                   const std::vector<float> &positions) {
+  std::vector<Meshlet> meshlets;
+  // stamp of the meshlet that last referenced each vertex
+  std::vector<uint32_t> lastMeshlet(positions.size() / 3, ~0U);
+
+  Meshlet current = {};
+  auto finish = [&]() {
+    if (current.indexCount == 0) {
+      return;
+    }
+    computeMeshletBounds(&indices[current.firstIndex], current.indexCount,
+                         positions, current);
+    meshlets.push_back(current);
+    current = Meshlet();
+    current.firstIndex = static_cast<uint32_t>(
+        meshlets.back().firstIndex + meshlets.back().indexCount);
+  };
+
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const uint32_t stamp = static_cast<uint32_t>(meshlets.size());
+    uint32_t newVertices = 0;
+    for (int k = 0; k < 3; ++k) {
+      if (lastMeshlet[indices[i + k]] != stamp) {
+        ++newVertices;
+      }
+    }
+    if (current.vertexCount + newVertices > MESHLET_MAX_VERTICES ||
+        current.indexCount / 3 + 1 > MESHLET_MAX_TRIANGLES) {
+      finish();
+    }
+
+    const uint32_t id = static_cast<uint32_t>(meshlets.size());
+    for (int k = 0; k < 3; ++k) {
+      if (lastMeshlet[indices[i + k]] != id) {
+        lastMeshlet[indices[i + k]] = id;
+        ++current.vertexCount;
+      }
+    }
+    current.indexCount += 3;
+  }
+  finish();
+  return meshlets;
+}
+
+void computeMeshletBounds(const uint32_t *indices, uint32_t indexCount,
+                          const std::vector<float> &positions,
+                          Meshlet &meshlet) {
+  float boundsMin[3], boundsMax[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    boundsMin[axis] = positions[indices[0] * 3 + axis];
+    boundsMax[axis] = boundsMin[axis];
+  }
+  for (uint32_t i = 0; i < indexCount; ++i) {
+    const float *p = &positions[indices[i] * 3];
+    for (int axis = 0; axis < 3; ++axis) {
+      boundsMin[axis] = std::min(boundsMin[axis], p[axis]);
+      boundsMax[axis] = std::max(boundsMax[axis], p[axis]);
+    }
+  }
+  float radiusSquared = 0.0f;
+  for (int axis = 0; axis < 3; ++axis) {
+    meshlet.center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+  }
+  for (uint32_t i = 0; i < indexCount; ++i) {
+    const float *p = &positions[indices[i] * 3];
+    float dx = p[0] - meshlet.center[0], dy = p[1] - meshlet.center[1],
+          dz = p[2] - meshlet.center[2];
+    radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+  }
+  meshlet.radius = std::sqrt(radiusSquared);
+
+  // the cone axis is the average triangle normal, its spread the largest
+  // angle between the axis and any triangle normal
+  std::vector<float> normals;
+  normals.reserve(indexCount);
+  float axis[3] = {0.0f, 0.0f, 0.0f};
+  for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+    const float *a = &positions[indices[i] * 3];
+    const float *b = &positions[indices[i + 1] * 3];
+    const float *c = &positions[indices[i + 2] * 3];
+    float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                  e1[0] * e2[1] - e1[1] * e2[0]};
+    if (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f) {
+      continue;
+    }
+    normalize(n);
+    normals.insert(normals.end(), n, n + 3);
+    axis[0] += n[0];
+    axis[1] += n[1];
+    axis[2] += n[2];
+  }
+  normalize(axis);
+
+  float minDot = 1.0f;
+  for (size_t i = 0; i < normals.size(); i += 3) {
+    float d = normals[i] * axis[0] + normals[i + 1] * axis[1] +
+              normals[i + 2] * axis[2];
+    minDot = std::min(minDot, d);
+  }
+  std::copy(axis, axis + 3, meshlet.coneAxis);
+  if (normals.empty() || minDot <= MIN_CONE_SPREAD) {
+    meshlet.coneCutoff = 1.0f;
+  } else {
+    // sin of the spread angle: back facing once the view direction is within
+    // 90 degrees minus the spread of the axis
+    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+  }
+}
@@ -0,0 +1,39 @@
+#include "parallel_for.h"
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+
+void parallelFor(uint32_t count, uint32_t grain,
+                 const std::function<void(uint32_t, uint32_t)> &body) {
+  if (grain == 0) {
+    grain = 1;
+  }
+  const uint32_t ranges = (count + grain - 1) / grain;
+  JobSystem &jobs = jobSystem();
+  // the calling thread takes a share as well
+  const uint32_t helpers =
+      ranges > 1 ? std::min(jobs.workerCount(), ranges - 1) : 0;
+  if (helpers == 0) {
+    if (count > 0) {
+      body(0, count);
+    }
+    return;
+  }
+
+  std::atomic<uint32_t> next(0);
+  auto worker = [&]() {
+    for (uint32_t range = next++; range < ranges; range = next++) {
+      TRACE_SCOPE("parallelFor");
+      uint32_t begin = range * grain;
+      body(begin, std::min(count, begin + grain));
+    }
+  };
+  JobSystem::Counter counter;
+  for (uint32_t i = 0; i < helpers; ++i) {
+    jobs.run(counter, worker);
+  }
+  worker();
+  jobs.wait(counter);
+}
@@ -0,0 +1,111 @@
+#include "pass_queries.h"
+#include "logging.h"
+
+namespace {
+
+// in the order vkGetQueryPoolResults returns them, lowest bit first
+const VkQueryPipelineStatisticFlags STATISTICS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+const uint32_t STATISTICS_COUNT = 4;
+
+const VkQueryResultFlags READ_FLAGS =
+    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+
+} // namespace
+
+void PassQueries::create(VkDevice dev, uint32_t slots, bool statistics,
+                         bool precise) {
+  device = dev;
+  pending.assign(slots, false);
+
+  VkQueryPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryCount = slots;
+  if (statistics) {
+    poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    poolInfo.pipelineStatistics = STATISTICS;
+    if (vkCreateQueryPool(device, &poolInfo, hostAllocator(),
+                          statisticsPool.replace(device)) != VK_SUCCESS) {
+      LOG(ERROR) << "Fail to create pipeline statistics query pool.";
+      statisticsPool.release();
+    }
+  }
+
+  poolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+  poolInfo.pipelineStatistics = 0;
+  if (vkCreateQueryPool(device, &poolInfo, hostAllocator(),
+                        occlusionPool.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create occlusion query pool.";
+    occlusionPool.release();
+  }
+  occlusionFlags = 0;
+  if (precise) {
+    occlusionFlags = VK_QUERY_CONTROL_PRECISE_BIT;
+  }
+}
+
+void PassQueries::destroy() {
+  statisticsPool.reset();
+  occlusionPool.reset();
+  pending.clear();
+}
+
+void PassQueries::begin(VkCommandBuffer commandBuffer, uint32_t slot) {
+  if (statisticsPool) {
+    vkCmdResetQueryPool(commandBuffer, statisticsPool, slot, 1);
+    vkCmdBeginQuery(commandBuffer, statisticsPool, slot, 0);
+  }
+  if (occlusionPool) {
+    vkCmdResetQueryPool(commandBuffer, occlusionPool, slot, 1);
+    vkCmdBeginQuery(commandBuffer, occlusionPool, slot, occlusionFlags);
+  }
+}
+
+void PassQueries::end(VkCommandBuffer commandBuffer, uint32_t slot) {
+  if (occlusionPool) {
+    vkCmdEndQuery(commandBuffer, occlusionPool, slot);
+  }
+  if (statisticsPool) {
+    vkCmdEndQuery(commandBuffer, statisticsPool, slot);
+  }
+}
+
+void PassQueries::submitted(uint32_t slot) { pending[slot] = true; }
+
+bool PassQueries::read(uint32_t slot, Results &results) {
+  if (slot >= pending.size() || !pending[slot]) {
+    return false;
+  }
+  results = Results();
+
+  // the last value of each result is its availability
+  if (statisticsPool) {
+    uint64_t values[STATISTICS_COUNT + 1] = {};
+    if (vkGetQueryPoolResults(device, statisticsPool, slot, 1, sizeof(values),
+                              values, sizeof(values),
+                              READ_FLAGS) != VK_SUCCESS ||
+        values[STATISTICS_COUNT] == 0) {
+      return false;
+    }
+    results.statistics = true;
+    results.inputAssemblyVertices = values[0];
+    results.vertexShaderInvocations = values[1];
+    results.clippingPrimitives = values[2];
+    results.fragmentShaderInvocations = values[3];
+  }
+  if (occlusionPool) {
+    uint64_t values[2] = {};
+    if (vkGetQueryPoolResults(device, occlusionPool, slot, 1, sizeof(values),
+                              values, sizeof(values),
+                              READ_FLAGS) != VK_SUCCESS ||
+        values[1] == 0) {
+      return false;
+    }
+    results.samplesPassed = values[0];
+  }
+  pending[slot] = false;
+  return true;
+}
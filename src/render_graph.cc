@@ -0,0 +1,656 @@
+#include "render_graph.h"
+#include "logging.h"
+
+#include <algorithm>
+
+namespace {
+
+struct UsageInfo {
+  VkPipelineStageFlags stages;
+  VkAccessFlags readAccess;
+  VkAccessFlags writeAccess;
+  VkImageLayout layout;
+  VkImageUsageFlags imageUsage;
+};
+
+UsageInfo getUsageInfo(ResourceUsage usage) {
+  switch (usage) {
+  case ResourceUsage::ColorAttachment:
+    return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+  case ResourceUsage::DepthAttachment:
+    return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+  case ResourceUsage::DepthRead:
+    return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+  case ResourceUsage::SampledFragment:
+    return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_SAMPLED_BIT};
+  case ResourceUsage::SampledCompute:
+    return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_USAGE_SAMPLED_BIT};
+  case ResourceUsage::Storage:
+    return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_USAGE_STORAGE_BIT};
+  case ResourceUsage::TransferSrc:
+    return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, 0,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT};
+  case ResourceUsage::TransferDst:
+    return {VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+  }
+  return {};
+}
+
+bool isDepthFormat(VkFormat format) {
+  return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT ||
+         format == VK_FORMAT_D24_UNORM_S8_UINT ||
+         format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+VkImageAspectFlags aspectOf(VkFormat format) {
+  if (!isDepthFormat(format)) {
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+  if (format == VK_FORMAT_D24_UNORM_S8_UINT ||
+      format == VK_FORMAT_D32_SFLOAT_S8_UINT) {
+    return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  }
+  return VK_IMAGE_ASPECT_DEPTH_BIT;
+}
+
+} // namespace
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::read(ResourceId resource,
+                                                         ResourceUsage usage) {
+  std::vector<Access> &accesses = graph.passes[pass].accesses;
+  for (auto &access : accesses) {
+    if (access.resource == resource) {
+      if (access.usage != usage) {
+        LOG(WARNING) << "Render graph: pass " << graph.passes[pass].name
+                     << " uses " << graph.resources[resource].name
+                     << " in two different ways.";
+      }
+      return *this;
+    }
+  }
+  accesses.push_back({resource, usage, false});
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::write(ResourceId resource,
+                                                          ResourceUsage usage) {
+  std::vector<Access> &accesses = graph.passes[pass].accesses;
+  for (auto &access : accesses) {
+    if (access.resource == resource) {
+      if (access.usage != usage) {
+        LOG(WARNING) << "Render graph: pass " << graph.passes[pass].name
+                     << " uses " << graph.resources[resource].name
+                     << " in two different ways.";
+      }
+      // a write wins over a read of the same resource
+      access.usage = usage;
+      access.write = true;
+      return *this;
+    }
+  }
+  accesses.push_back({resource, usage, true});
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::sideEffects() {
+  graph.passes[pass].sideEffects = true;
+  return *this;
+}
+
+RenderGraph::ResourceId RenderGraph::importImage(
+    const std::string &name, const ImageDesc &desc, VkImageLayout initialLayout,
+    VkPipelineStageFlags initialStage, VkImageLayout finalLayout) {
+  Resource resource;
+  resource.name = name;
+  resource.desc = desc;
+  resource.imported = true;
+  resource.initialLayout = initialLayout;
+  resource.initialStage = initialStage;
+  resource.finalLayout = finalLayout;
+  resources.push_back(resource);
+  return static_cast<ResourceId>(resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::createImage(const std::string &name,
+                                                 const ImageDesc &desc) {
+  Resource resource;
+  resource.name = name;
+  resource.desc = desc;
+  resources.push_back(resource);
+  return static_cast<ResourceId>(resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::createAttachment(const std::string &name,
+                                                      const ImageDesc &desc) {
+  ResourceId id = createImage(name, desc);
+  resources[id].attachment = true;
+  return id;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const std::string &name,
+                                              RecordFunc record) {
+  Pass pass;
+  pass.name = name;
+  pass.record = std::move(record);
+  passes.push_back(pass);
+  return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+void RenderGraph::compile(VkPhysicalDevice physicalDevice, VkDevice device) {
+  cullPasses();
+  computeLifetimes();
+  allocateTransients(physicalDevice, device);
+  computeBarriers();
+}
+
+void RenderGraph::cullPasses() {
+  // imported images are what the graph produces for the outside world
+  std::vector<bool> needed(resources.size(), false);
+  for (size_t i = 0; i < resources.size(); ++i) {
+    needed[i] = resources[i].imported;
+  }
+
+  // passes are declared in execution order, so every producer is visited
+  // after all of its consumers
+  for (size_t i = passes.size(); i-- > 0;) {
+    Pass &pass = passes[i];
+    bool live = pass.sideEffects;
+    for (const auto &access : pass.accesses) {
+      if (access.write && needed[access.resource]) {
+        live = true;
+      }
+    }
+    pass.culled = !live;
+    if (!live) {
+      LOG(INFO) << "Render graph: culled pass " << pass.name;
+      continue;
+    }
+    for (const auto &access : pass.accesses) {
+      if (!access.write) {
+        needed[access.resource] = true;
+      }
+    }
+  }
+
+  order.clear();
+  for (uint32_t i = 0; i < passes.size(); ++i) {
+    if (!passes[i].culled) {
+      order.push_back(i);
+    }
+  }
+}
+
+void RenderGraph::computeLifetimes() {
+  for (auto &resource : resources) {
+    resource.firstUse = -1;
+    resource.lastUse = -1;
+    resource.usage = 0;
+  }
+  for (int i = 0; i < static_cast<int>(order.size()); ++i) {
+    for (const auto &access : passes[order[i]].accesses) {
+      Resource &resource = resources[access.resource];
+      if (resource.firstUse < 0) {
+        resource.firstUse = i;
+      }
+      resource.lastUse = i;
+      resource.usage |= getUsageInfo(access.usage).imageUsage;
+    }
+  }
+}
+
+void RenderGraph::allocateTransients(VkPhysicalDevice physicalDevice,
+                                     VkDevice device) {
+  std::vector<ResourceId> transients;
+  std::vector<VkMemoryRequirements> requirements(resources.size());
+  VkDeviceSize unaliasedSize = 0;
+
+  for (ResourceId id = 0; id < resources.size(); ++id) {
+    Resource &resource = resources[id];
+    if (resource.imported || resource.firstUse < 0) {
+      continue;
+    }
+    const VkImageUsageFlags attachmentUsage =
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+        VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+    if (resource.attachment && (resource.usage & ~attachmentUsage) != 0) {
+      LOG(WARNING) << "Render graph: " << resource.name
+                   << " is used as more than an attachment.";
+      resource.attachment = false;
+    }
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = resource.desc.format;
+    imageInfo.extent = {resource.desc.extent.width,
+                        resource.desc.extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = resource.desc.samples;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = resource.usage;
+    if (resource.attachment) {
+      imageInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    transientImages.emplace_back();
+    if (vkCreateImage(device, &imageInfo, hostAllocator(),
+                      transientImages.back().replace(device)) != VK_SUCCESS) {
+      LOG(ERROR) << "Render graph: fail to create image " << resource.name;
+      continue;
+    }
+    resource.image = transientImages.back();
+    vkGetImageMemoryRequirements(device, resource.image, &requirements[id]);
+    unaliasedSize += requirements[id].size;
+    transients.push_back(id);
+  }
+
+  // Greedy interval packing: biggest images first, each one goes into the
+  // first block whose current occupants are all dead before it is born or
+  // born after it dies. Every image is bound at offset 0 of its block.
+  std::sort(transients.begin(), transients.end(),
+            [&requirements](ResourceId a, ResourceId b) {
+              return requirements[a].size > requirements[b].size;
+            });
+  memoryBlocks.clear();
+  for (ResourceId id : transients) {
+    const Resource &resource = resources[id];
+    int chosen = -1;
+    for (size_t b = 0; b < memoryBlocks.size() && chosen < 0; ++b) {
+      MemoryBlock &block = memoryBlocks[b];
+      if ((block.memoryTypeBits & requirements[id].memoryTypeBits) == 0 ||
+          block.attachment != resource.attachment) {
+        continue;
+      }
+      bool overlaps = false;
+      for (ResourceId other : block.occupants) {
+        if (resource.firstUse <= resources[other].lastUse &&
+            resources[other].firstUse <= resource.lastUse) {
+          overlaps = true;
+          break;
+        }
+      }
+      if (!overlaps) {
+        chosen = static_cast<int>(b);
+      }
+    }
+    if (chosen < 0) {
+      memoryBlocks.emplace_back();
+      chosen = static_cast<int>(memoryBlocks.size() - 1);
+      memoryBlocks.back().attachment = resource.attachment;
+    }
+    MemoryBlock &block = memoryBlocks[chosen];
+    block.size = std::max(block.size, requirements[id].size);
+    block.memoryTypeBits &= requirements[id].memoryTypeBits;
+    block.occupants.push_back(id);
+    resources[id].memoryBlock = chosen;
+  }
+
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  VkDeviceSize aliasedSize = 0;
+  lazySize = 0;
+  for (auto &block : memoryBlocks) {
+    std::sort(block.occupants.begin(), block.occupants.end(),
+              [this](ResourceId a, ResourceId b) {
+                return resources[a].firstUse < resources[b].firstUse;
+              });
+
+    // attachments prefer lazily allocated memory, typically only found on
+    // tile based GPUs, and fall back to plain device local memory
+    auto findMemoryType = [&](VkMemoryPropertyFlags flags) {
+      for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        if ((block.memoryTypeBits & (1U << i)) &&
+            (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags) {
+          return i;
+        }
+      }
+      return memoryProperties.memoryTypeCount;
+    };
+    uint32_t memoryType = memoryProperties.memoryTypeCount;
+    if (block.attachment) {
+      memoryType = findMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                  VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+      block.lazy = memoryType != memoryProperties.memoryTypeCount;
+    }
+    if (memoryType == memoryProperties.memoryTypeCount) {
+      memoryType = findMemoryType(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+    if (memoryType == memoryProperties.memoryTypeCount) {
+      LOG(ERROR) << "Render graph: no device local memory type for images.";
+      continue;
+    }
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = block.size;
+    allocInfo.memoryTypeIndex = memoryType;
+    transientMemory.emplace_back();
+    if (allocateDeviceMemory(device, &allocInfo, hostAllocator(),
+                             transientMemory.back().replace(device)) !=
+        VK_SUCCESS) {
+      LOG(ERROR) << "Render graph: fail to allocate transient memory.";
+      continue;
+    }
+    block.memory = transientMemory.back();
+    aliasedSize += block.size;
+    if (block.lazy) {
+      lazySize += block.size;
+    }
+
+    for (ResourceId id : block.occupants) {
+      Resource &resource = resources[id];
+      vkBindImageMemory(device, resource.image, transientMemory.back(), 0);
+
+      VkImageViewCreateInfo viewInfo = {};
+      viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewInfo.image = resource.image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.format = resource.desc.format;
+      viewInfo.subresourceRange.aspectMask = aspectOf(resource.desc.format);
+      viewInfo.subresourceRange.baseMipLevel = 0;
+      viewInfo.subresourceRange.levelCount = 1;
+      viewInfo.subresourceRange.baseArrayLayer = 0;
+      viewInfo.subresourceRange.layerCount = 1;
+      transientViews.emplace_back();
+      if (vkCreateImageView(device, &viewInfo, hostAllocator(),
+                            transientViews.back().replace(device)) !=
+          VK_SUCCESS) {
+        LOG(ERROR) << "Render graph: fail to create view of " << resource.name;
+      }
+      resource.view = transientViews.back();
+    }
+  }
+
+  if (!transients.empty()) {
+    LOG(INFO) << "Render graph: " << transients.size()
+              << " transient images in " << memoryBlocks.size()
+              << " memory blocks, " << aliasedSize << " bytes ("
+              << unaliasedSize << " bytes without aliasing), " << lazySize
+              << " of them lazily allocated";
+  }
+}
+
+VkDeviceSize RenderGraph::lazyCommitment(VkDevice device) const {
+  VkDeviceSize committed = 0;
+  for (const auto &block : memoryBlocks) {
+    if (block.lazy && block.memory != VK_NULL_HANDLE) {
+      VkDeviceSize bytes = 0;
+      vkGetDeviceMemoryCommitment(device, block.memory, &bytes);
+      committed += bytes;
+    }
+  }
+  return committed;
+}
+
+void RenderGraph::computeBarriers() {
+  struct State {
+    VkImageLayout layout;
+    // stages and access of the last write or layout transition
+    VkPipelineStageFlags writeStages;
+    VkAccessFlags writeAccess;
+    // stages that read the image since then
+    VkPipelineStageFlags readStages;
+    // stages and access the last write has already been made visible to
+    VkPipelineStageFlags visibleStages;
+    VkAccessFlags visibleAccess;
+  };
+
+  std::vector<State> states(resources.size());
+  // position of the barrier that starts each transient's lifetime
+  std::vector<std::pair<int, size_t>> firstBarrier(resources.size(),
+                                                   std::make_pair(-1, 0));
+  for (size_t i = 0; i < resources.size(); ++i) {
+    State &s = states[i];
+    s.layout = resources[i].initialLayout;
+    s.writeStages = resources[i].initialStage;
+    s.writeAccess = 0;
+    s.readStages = 0;
+    s.visibleStages = 0;
+    s.visibleAccess = 0;
+  }
+
+  passBarriers.assign(order.size(), BarrierBatch());
+  for (size_t p = 0; p < order.size(); ++p) {
+    BarrierBatch &batch = passBarriers[p];
+    for (const auto &access : passes[order[p]].accesses) {
+      const Resource &resource = resources[access.resource];
+      const UsageInfo info = getUsageInfo(access.usage);
+      State &s = states[access.resource];
+      VkAccessFlags dstAccess =
+          access.write ? info.readAccess | info.writeAccess : info.readAccess;
+      bool firstUse = !resource.imported &&
+                      resource.firstUse == static_cast<int>(p);
+
+      if (firstUse && !access.write) {
+        LOG(WARNING) << "Render graph: " << resource.name
+                     << " is read by " << passes[order[p]].name
+                     << " before anything writes it.";
+      }
+
+      if (s.layout != info.layout || access.write || firstUse) {
+        // write-after-write, write-after-read or a layout transition: wait
+        // for every earlier user of the image
+        VkPipelineStageFlags srcStages = s.writeStages | s.readStages;
+        if (s.layout != info.layout || srcStages != 0 || firstUse) {
+          if (firstUse) {
+            firstBarrier[access.resource] =
+                std::make_pair(static_cast<int>(p), batch.barriers.size());
+          }
+          batch.srcStages |= srcStages;
+          batch.dstStages |= info.stages;
+          // a transient's old contents are never needed
+          batch.barriers.push_back({access.resource, srcStages, info.stages,
+                                    s.writeAccess, dstAccess,
+                                    firstUse ? VK_IMAGE_LAYOUT_UNDEFINED
+                                             : s.layout,
+                                    info.layout});
+        }
+        s.layout = info.layout;
+        s.writeStages = info.stages;
+        if (access.write) {
+          s.writeAccess = info.writeAccess;
+          s.readStages = 0;
+          s.visibleStages = 0;
+          s.visibleAccess = 0;
+        } else {
+          // the transition is visible to this reader already
+          s.writeAccess = 0;
+          s.readStages = info.stages;
+          s.visibleStages = info.stages;
+          s.visibleAccess = info.readAccess;
+        }
+        continue;
+      }
+
+      // read-after-read in the same layout needs no barrier; a read after a
+      // write only needs one if the write is not yet visible to this stage
+      if ((info.stages & ~s.visibleStages) != 0 ||
+          (info.readAccess & ~s.visibleAccess) != 0) {
+        if (s.writeStages != 0) {
+          batch.srcStages |= s.writeStages;
+          batch.dstStages |= info.stages;
+          batch.barriers.push_back({access.resource, s.writeStages,
+                                    info.stages, s.writeAccess, dstAccess,
+                                    s.layout, s.layout});
+        }
+        s.visibleStages |= info.stages;
+        s.visibleAccess |= info.readAccess;
+      }
+      s.readStages |= info.stages;
+    }
+  }
+
+  // The first barrier of an aliased image must also wait for the previous
+  // occupant of its memory. The first occupant waits for the last one, which
+  // orders this frame after the previous submission of the graph.
+  for (const auto &block : memoryBlocks) {
+    for (size_t i = 0; i < block.occupants.size(); ++i) {
+      ResourceId id = block.occupants[i];
+      ResourceId previous =
+          block.occupants[(i + block.occupants.size() - 1) %
+                          block.occupants.size()];
+      if (firstBarrier[id].first < 0) {
+        continue;
+      }
+      BarrierBatch &batch = passBarriers[firstBarrier[id].first];
+      Barrier &barrier = batch.barriers[firstBarrier[id].second];
+      VkPipelineStageFlags previousStages =
+          states[previous].writeStages | states[previous].readStages;
+      batch.srcStages |= previousStages;
+      barrier.srcStages |= previousStages;
+      barrier.srcAccess = states[previous].writeAccess;
+    }
+  }
+
+  finalBarriers = BarrierBatch();
+  for (ResourceId id = 0; id < resources.size(); ++id) {
+    const Resource &resource = resources[id];
+    const State &s = states[id];
+    if (!resource.imported ||
+        resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED ||
+        resource.finalLayout == s.layout) {
+      continue;
+    }
+    finalBarriers.srcStages |= s.writeStages | s.readStages;
+    finalBarriers.dstStages |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    finalBarriers.barriers.push_back(
+        {id, s.writeStages | s.readStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+         s.writeAccess, 0, s.layout, resource.finalLayout});
+  }
+
+  size_t barrierCount = finalBarriers.barriers.size();
+  for (const auto &batch : passBarriers) {
+    barrierCount += batch.barriers.size();
+  }
+  LOG(INFO) << "Render graph: " << order.size() << " of " << passes.size()
+            << " passes, " << barrierCount << " image barriers";
+}
+
+void RenderGraph::bindImage(ResourceId resource, VkImage image,
+                            VkImageView view) {
+  resources[resource].image = image;
+  resources[resource].view = view;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t index) const {
+  for (size_t p = 0; p < order.size(); ++p) {
+    recordBarriers(commandBuffer, passBarriers[p]);
+    const Pass &pass = passes[order[p]];
+    if (passObserver) {
+      passObserver(commandBuffer, index, pass.name, true);
+    }
+    pass.record(commandBuffer, index);
+    if (passObserver) {
+      passObserver(commandBuffer, index, pass.name, false);
+    }
+  }
+  recordBarriers(commandBuffer, finalBarriers);
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer,
+                                 const BarrierBatch &batch) const {
+  if (batch.barriers.empty()) {
+    return;
+  }
+  if (pipelineBarrier2 != nullptr) {
+    // synchronization 1 stage and access bits keep their values; an empty
+    // source and a BOTTOM_OF_PIPE destination both become NONE
+    std::vector<VkImageMemoryBarrier2> barriers(batch.barriers.size());
+    for (size_t i = 0; i < batch.barriers.size(); ++i) {
+      const Barrier &b = batch.barriers[i];
+      const Resource &resource = resources[b.resource];
+      VkImageMemoryBarrier2 &barrier = barriers[i];
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+      barrier.srcStageMask = b.srcStages;
+      barrier.srcAccessMask = b.srcAccess;
+      barrier.dstStageMask =
+          b.dstStages == VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+              ? VK_PIPELINE_STAGE_2_NONE
+              : static_cast<VkPipelineStageFlags2>(b.dstStages);
+      barrier.dstAccessMask = b.dstAccess;
+      barrier.oldLayout = b.oldLayout;
+      barrier.newLayout = b.newLayout;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = resource.image;
+      barrier.subresourceRange.aspectMask = aspectOf(resource.desc.format);
+      barrier.subresourceRange.baseMipLevel = 0;
+      // imported images may have mips, e.g. the Hi-Z pyramid
+      barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount = 1;
+    }
+    VkDependencyInfo dependency = {};
+    dependency.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+    dependency.pImageMemoryBarriers = barriers.data();
+    pipelineBarrier2(commandBuffer, &dependency);
+    return;
+  }
+
+  std::vector<VkImageMemoryBarrier> barriers(batch.barriers.size());
+  for (size_t i = 0; i < batch.barriers.size(); ++i) {
+    const Barrier &b = batch.barriers[i];
+    const Resource &resource = resources[b.resource];
+    VkImageMemoryBarrier &barrier = barriers[i];
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = b.srcAccess;
+    barrier.dstAccessMask = b.dstAccess;
+    barrier.oldLayout = b.oldLayout;
+    barrier.newLayout = b.newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = resource.image;
+    barrier.subresourceRange.aspectMask = aspectOf(resource.desc.format);
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+  }
+  vkCmdPipelineBarrier(
+      commandBuffer,
+      batch.srcStages ? batch.srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      batch.dstStages ? batch.dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()),
+      barriers.data());
+}
+
+void RenderGraph::reset() {
+  transientViews.clear();
+  transientImages.clear();
+  transientMemory.clear();
+  memoryBlocks.clear();
+  lazySize = 0;
+  passes.clear();
+  resources.clear();
+  order.clear();
+  passBarriers.clear();
+  finalBarriers = BarrierBatch();
+}
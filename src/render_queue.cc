@@ -0,0 +1,161 @@
+#include "render_queue.h"
+
+#include <cstring>
+
+uint64_t RenderQueue::makeSortKey(uint32_t pass, uint32_t pipeline,
+                                  uint32_t descriptorSet, float depth,
+                                  bool backToFront) {
+  // the bit pattern of a non-negative float grows with its value
+  if (!(depth > 0.0f)) {
+    depth = 0.0f;
+  }
+  uint32_t depthBits;
+  std::memcpy(&depthBits, &depth, sizeof(depthBits));
+  if (backToFront) {
+    depthBits = ~depthBits;
+  }
+  return (static_cast<uint64_t>(pass & 0xF) << 60) |
+         (static_cast<uint64_t>(pipeline & 0xFFF) << 48) |
+         (static_cast<uint64_t>(descriptorSet & 0xFFFF) << 32) | depthBits;
+}
+
+void RenderQueue::clear() {
+  packets.clear();
+  keys.clear();
+  indices.clear();
+}
+
+void RenderQueue::push(const DrawPacket &packet) {
+  keys.push_back(packet.sortKey);
+  indices.push_back(static_cast<uint32_t>(packets.size()));
+  packets.push_back(packet);
+}
+
+void RenderQueue::sort() {
+  stats = Stats();
+  const size_t n = keys.size();
+  keysScratch.resize(n);
+  indicesScratch.resize(n);
+
+  // LSD radix sort, 8 bits per pass. Stable, so packets with equal keys keep
+  // their submission order.
+  for (int shift = 0; shift < 64; shift += 8) {
+    uint32_t histogram[256] = {};
+    for (size_t i = 0; i < n; ++i) {
+      ++histogram[(keys[i] >> shift) & 0xFF];
+    }
+    // every key has the same byte here, the pass would not move anything
+    if (n == 0 || histogram[(keys[0] >> shift) & 0xFF] == n) {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (auto &bucket : histogram) {
+      uint32_t count = bucket;
+      bucket = offset;
+      offset += count;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t dst = histogram[(keys[i] >> shift) & 0xFF]++;
+      keysScratch[dst] = keys[i];
+      indicesScratch[dst] = indices[i];
+    }
+    keys.swap(keysScratch);
+    indices.swap(indicesScratch);
+  }
+}
+
+void RenderQueue::flush(VkCommandBuffer commandBuffer, uint32_t pass) {
+  VkPipeline boundPipeline = VK_NULL_HANDLE;
+  VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+  VkDescriptorSet boundSet = VK_NULL_HANDLE;
+  VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+  VkDeviceSize boundVertexOffset = 0;
+  VkBuffer boundInstanceBuffer = VK_NULL_HANDLE;
+  VkDeviceSize boundInstanceOffset = 0;
+  VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+  VkDeviceSize boundIndexOffset = 0;
+  VkIndexType boundIndexType = VK_INDEX_TYPE_UINT32;
+
+  for (size_t i = 0; i < indices.size(); ++i) {
+    // sorted by pass first, so the packets of `pass` are contiguous
+    const uint32_t keyPass = static_cast<uint32_t>(keys[i] >> 60);
+    if (keyPass < (pass & 0xF)) {
+      continue;
+    }
+    if (keyPass > (pass & 0xF)) {
+      break;
+    }
+    const DrawPacket &packet = packets[indices[i]];
+
+    if (packet.pipeline != boundPipeline) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        packet.pipeline);
+      boundPipeline = packet.pipeline;
+      ++stats.pipelineBinds;
+    }
+
+    // a set bound through an incompatible layout has to be bound again
+    if (packet.descriptorSet != VK_NULL_HANDLE &&
+        (packet.descriptorSet != boundSet || packet.layout != boundLayout)) {
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              packet.layout, 0, 1, &packet.descriptorSet, 0,
+                              nullptr);
+      boundSet = packet.descriptorSet;
+      boundLayout = packet.layout;
+      ++stats.descriptorSetBinds;
+    }
+
+    if (packet.vertexBuffer != VK_NULL_HANDLE &&
+        (packet.vertexBuffer != boundVertexBuffer ||
+         packet.vertexBufferOffset != boundVertexOffset)) {
+      vkCmdBindVertexBuffers(commandBuffer, 0, 1, &packet.vertexBuffer,
+                             &packet.vertexBufferOffset);
+      boundVertexBuffer = packet.vertexBuffer;
+      boundVertexOffset = packet.vertexBufferOffset;
+      ++stats.vertexBufferBinds;
+    }
+
+    if (packet.instanceBuffer != VK_NULL_HANDLE &&
+        (packet.instanceBuffer != boundInstanceBuffer ||
+         packet.instanceBufferOffset != boundInstanceOffset)) {
+      vkCmdBindVertexBuffers(commandBuffer, 1, 1, &packet.instanceBuffer,
+                             &packet.instanceBufferOffset);
+      boundInstanceBuffer = packet.instanceBuffer;
+      boundInstanceOffset = packet.instanceBufferOffset;
+      ++stats.vertexBufferBinds;
+    }
+
+    if (packet.indexBuffer != VK_NULL_HANDLE) {
+      if (packet.indexBuffer != boundIndexBuffer ||
+          packet.indexBufferOffset != boundIndexOffset ||
+          packet.indexType != boundIndexType) {
+        vkCmdBindIndexBuffer(commandBuffer, packet.indexBuffer,
+                             packet.indexBufferOffset, packet.indexType);
+        boundIndexBuffer = packet.indexBuffer;
+        boundIndexOffset = packet.indexBufferOffset;
+        boundIndexType = packet.indexType;
+        ++stats.indexBufferBinds;
+      }
+    }
+    if (packet.indirectBuffer != VK_NULL_HANDLE) {
+      if (packet.indexBuffer != VK_NULL_HANDLE) {
+        vkCmdDrawIndexedIndirect(commandBuffer, packet.indirectBuffer,
+                                 packet.indirectOffset, packet.count,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+      } else {
+        vkCmdDrawIndirect(commandBuffer, packet.indirectBuffer,
+                          packet.indirectOffset, packet.count,
+                          sizeof(VkDrawIndirectCommand));
+      }
+    } else if (packet.indexBuffer != VK_NULL_HANDLE) {
+      vkCmdDrawIndexed(commandBuffer, packet.count, packet.instanceCount,
+                       packet.first, packet.vertexOffset,
+                       packet.firstInstance);
+    } else {
+      vkCmdDraw(commandBuffer, packet.count, packet.instanceCount,
+                packet.first, packet.firstInstance);
+    }
+    ++stats.draws;
+  }
+}
@@ -0,0 +1,29 @@
+#include "resolution_scaler.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool ResolutionScaler::update(double gpuMilliseconds) {
+  sum += gpuMilliseconds;
+  if (++frames < WINDOW) {
+    return false;
+  }
+  double average = sum / frames;
+  sum = 0.0;
+  frames = 0;
+  if (average <= 0.0 || std::abs(average - target) <= target * DEADBAND) {
+    return false;
+  }
+
+  // GPU time is roughly proportional to the pixel count, the square of the
+  // scale
+  float wanted = current * static_cast<float>(std::sqrt(target / average));
+  wanted = std::min(std::max(wanted, current - MAX_STEP), current + MAX_STEP);
+  wanted = std::round(wanted / SCALE_STEP) * SCALE_STEP;
+  wanted = std::min(std::max(wanted, minScale), maxScale);
+  if (wanted == current) {
+    return false;
+  }
+  current = wanted;
+  return true;
+}
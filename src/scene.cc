@@ -0,0 +1,247 @@
+#include "scene.h"
+#include "logging.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MYVK_SCENE_SSE
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+inline uint32_t countTrailingZeros(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<uint32_t>(index);
+#else
+  return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+}
+
+glm::mat4 composeTransform(const glm::vec3 &p, const glm::quat &q,
+                           const glm::vec3 &s) {
+  float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+  glm::mat4 m(1.0f);
+  m[0] = glm::vec4((1.0f - 2.0f * (yy + zz)) * s.x, 2.0f * (xy + wz) * s.x,
+                   2.0f * (xz - wy) * s.x, 0.0f);
+  m[1] = glm::vec4(2.0f * (xy - wz) * s.y, (1.0f - 2.0f * (xx + zz)) * s.y,
+                   2.0f * (yz + wx) * s.y, 0.0f);
+  m[2] = glm::vec4(2.0f * (xz + wy) * s.z, 2.0f * (yz - wx) * s.z,
+                   (1.0f - 2.0f * (xx + yy)) * s.z, 0.0f);
+  m[3] = glm::vec4(p.x, p.y, p.z, 1.0f);
+  return m;
+}
+
+// radius of spheres in padding lanes, fails every plane test
+const float NEVER_VISIBLE = -std::numeric_limits<float>::max();
+
+} // namespace
+
+Scene::EntityId Scene::createEntity(EntityId parent, const glm::vec3 &position,
+                                    const glm::quat &rotation,
+                                    const glm::vec3 &scale,
+                                    const glm::vec4 &bounds) {
+  const EntityId id = size();
+  if (parent != NO_PARENT && parent >= id) {
+    LOG(ERROR) << "Scene: parent " << parent << " of entity " << id
+               << " does not exist, creating it as a root.";
+    parent = NO_PARENT;
+  }
+  positions.push_back(position);
+  rotations.push_back(rotation);
+  scales.push_back(scale);
+  localBounds.push_back(bounds);
+  parents.push_back(parent);
+  worldMatrices.push_back(glm::mat4(1.0f));
+
+  uint32_t depth = parent == NO_PARENT ? 0 : depths[parent] + 1;
+  depths.push_back(depth);
+  if (levels.size() <= depth) {
+    levels.resize(depth + 1);
+  }
+  levels[depth].push_back(id);
+
+  // not visible until the first updateTransforms()
+  size_t padded = (static_cast<size_t>(id) + 8) / 8 * 8;
+  boundsX.resize(padded, 0.0f);
+  boundsY.resize(padded, 0.0f);
+  boundsZ.resize(padded, 0.0f);
+  boundsRadius.resize(padded, NEVER_VISIBLE);
+  return id;
+}
+
+void Scene::updateTransforms() {
+  // parents are one level up, so they are final once their level is done
+  for (const auto &level : levels) {
+    parallelFor(
+        static_cast<uint32_t>(level.size()), CHUNK_SIZE,
+        [&](uint32_t begin, uint32_t end) {
+          for (uint32_t i = begin; i < end; ++i) {
+            const EntityId id = level[i];
+            glm::mat4 world =
+                composeTransform(positions[id], rotations[id], scales[id]);
+            if (parents[id] != NO_PARENT) {
+              world = worldMatrices[parents[id]] * world;
+            }
+            worldMatrices[id] = world;
+
+            const glm::vec4 &local = localBounds[id];
+            glm::vec4 center =
+                world * glm::vec4(local.x, local.y, local.z, 1.0f);
+            float scale = std::max(glm::length(glm::vec3(world[0])),
+                                   std::max(glm::length(glm::vec3(world[1])),
+                                            glm::length(glm::vec3(world[2]))));
+            boundsX[id] = center.x;
+            boundsY[id] = center.y;
+            boundsZ[id] = center.z;
+            boundsRadius[id] = local.w * scale;
+          }
+        });
+  }
+}
+
+void Scene::cullRange(const glm::vec4 planes[6], uint32_t begin, uint32_t end,
+                      uint64_t *mask) const {
+  uint32_t i = begin;
+#if defined(__AVX__)
+  // 8 spheres per instruction; lanes past size() are padding
+  for (; i < end; i += 8) {
+    __m256 x = _mm256_loadu_ps(&boundsX[i]);
+    __m256 y = _mm256_loadu_ps(&boundsY[i]);
+    __m256 z = _mm256_loadu_ps(&boundsZ[i]);
+    __m256 negRadius =
+        _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&boundsRadius[i]));
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; ++p) {
+      __m256 d = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planes[p].x)),
+                        _mm256_mul_ps(y, _mm256_set1_ps(planes[p].y))),
+          _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(planes[p].z)),
+                        _mm256_set1_ps(planes[p].w)));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, negRadius, _CMP_GE_OQ));
+    }
+    uint64_t bits = static_cast<uint64_t>(_mm256_movemask_ps(inside));
+    mask[(i - begin) / 64] |= bits << ((i - begin) % 64);
+  }
+#elif defined(MYVK_SCENE_SSE)
+  // 4 spheres per instruction; lanes past size() are padding
+  for (; i < end; i += 4) {
+    __m128 x = _mm_loadu_ps(&boundsX[i]);
+    __m128 y = _mm_loadu_ps(&boundsY[i]);
+    __m128 z = _mm_loadu_ps(&boundsZ[i]);
+    __m128 negRadius =
+        _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&boundsRadius[i]));
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; ++p) {
+      __m128 d =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)),
+                                _mm_mul_ps(y, _mm_set1_ps(planes[p].y))),
+                     _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p].z)),
+                                _mm_set1_ps(planes[p].w)));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+    }
+    uint64_t bits = static_cast<uint64_t>(_mm_movemask_ps(inside));
+    mask[(i - begin) / 64] |= bits << ((i - begin) % 64);
+  }
+#else
+  for (; i < end; ++i) {
+    bool inside = true;
+    for (int p = 0; p < 6; ++p) {
+      float d = planes[p].x * boundsX[i] + planes[p].y * boundsY[i] +
+                planes[p].z * boundsZ[i] + planes[p].w;
+      inside = inside && d >= -boundsRadius[i];
+    }
+    if (inside) {
+      mask[(i - begin) / 64] |= uint64_t(1) << ((i - begin) % 64);
+    }
+  }
+#endif
+}
+
+uint32_t Scene::gatherVisible(
+    const glm::vec4 planes[6], uint32_t bucketCount,
+    const std::function<uint32_t(const glm::vec4 &)> &classify,
+    SceneInstance *instances, uint32_t capacity,
+    uint32_t *bucketCounts) const {
+  std::fill(bucketCounts, bucketCounts + bucketCount, 0U);
+  const uint32_t count = size();
+  if (count == 0 || bucketCount == 0) {
+    return 0;
+  }
+  const uint32_t chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  const uint32_t maskWords = CHUNK_SIZE / 64;
+
+  // pass 1: cull and classify, counting per chunk and bucket
+  std::vector<uint64_t> masks(static_cast<size_t>(chunks) * maskWords, 0);
+  std::vector<uint32_t> buckets(count);
+  std::vector<uint32_t> offsets(static_cast<size_t>(chunks) * bucketCount, 0);
+  parallelFor(chunks, 1, [&](uint32_t first, uint32_t last) {
+    for (uint32_t c = first; c < last; ++c) {
+      const uint32_t begin = c * CHUNK_SIZE;
+      const uint32_t end = std::min(count, begin + CHUNK_SIZE);
+      uint64_t *mask = &masks[static_cast<size_t>(c) * maskWords];
+      uint32_t *counts = &offsets[static_cast<size_t>(c) * bucketCount];
+      cullRange(planes, begin, end, mask);
+      for (uint32_t w = 0; w < maskWords; ++w) {
+        for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+          EntityId id = begin + w * 64 + countTrailingZeros(bits);
+          uint32_t bucket = std::min(classify(worldBounds(id)),
+                                     bucketCount - 1);
+          buckets[id] = bucket;
+          ++counts[bucket];
+        }
+      }
+    }
+  });
+
+  // turn the counts into output offsets: bucket-major, then chunk order
+  uint32_t total = 0;
+  for (uint32_t b = 0; b < bucketCount; ++b) {
+    uint32_t bucketStart = total;
+    for (uint32_t c = 0; c < chunks; ++c) {
+      uint32_t &slot = offsets[static_cast<size_t>(c) * bucketCount + b];
+      uint32_t n = slot;
+      slot = total;
+      total += n;
+    }
+    bucketCounts[b] = std::min(total, capacity) -
+                      std::min(bucketStart, capacity);
+  }
+
+  // pass 2: every chunk writes its own ranges of the output
+  parallelFor(chunks, 1, [&](uint32_t first, uint32_t last) {
+    for (uint32_t c = first; c < last; ++c) {
+      const uint32_t begin = c * CHUNK_SIZE;
+      const uint64_t *mask = &masks[static_cast<size_t>(c) * maskWords];
+      uint32_t *cursors = &offsets[static_cast<size_t>(c) * bucketCount];
+      for (uint32_t w = 0; w < maskWords; ++w) {
+        for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+          EntityId id = begin + w * 64 + countTrailingZeros(bits);
+          uint32_t slot = cursors[buckets[id]]++;
+          if (slot >= capacity) {
+            continue;
+          }
+          const glm::mat4 &m = worldMatrices[id];
+          SceneInstance &instance = instances[slot];
+          for (int r = 0; r < 3; ++r) {
+            instance.rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+          }
+        }
+      }
+    }
+  });
+  return std::min(total, capacity);
+}
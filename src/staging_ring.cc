@@ -0,0 +1,127 @@
+#include "staging_ring.h"
+#include "logging.h"
+
+void StagingRing::create(VkPhysicalDevice physicalDevice, VkDevice dev,
+                         VkDeviceSize ringSize) {
+  device = dev;
+  size = ringSize;
+  head = tail = used = 0;
+  regions.clear();
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(device, &bufferInfo, hostAllocator(),
+                     buffer.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to create staging buffer.";
+    return;
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device, buffer, &requirements);
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  const VkMemoryPropertyFlags wanted = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  uint32_t memoryType = memoryProperties.memoryTypeCount;
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+    if ((requirements.memoryTypeBits & (1U << i)) &&
+        (memoryProperties.memoryTypes[i].propertyFlags & wanted) == wanted) {
+      memoryType = i;
+      break;
+    }
+  }
+  if (memoryType == memoryProperties.memoryTypeCount) {
+    LOG(ERROR) << "No host coherent memory for the staging buffer.";
+    return;
+  }
+
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = requirements.size;
+  allocInfo.memoryTypeIndex = memoryType;
+  if (allocateDeviceMemory(device, &allocInfo, hostAllocator(),
+                           memory.replace(device)) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to allocate staging memory.";
+    return;
+  }
+  vkBindBufferMemory(device, buffer, memory, 0);
+
+  void *data = nullptr;
+  if (vkMapMemory(device, memory, 0, size, 0, &data) != VK_SUCCESS) {
+    LOG(ERROR) << "Fail to map staging memory.";
+  }
+  mapped = static_cast<char *>(data);
+}
+
+void StagingRing::destroy() {
+  if (mapped != nullptr) {
+    vkUnmapMemory(device, memory);
+    mapped = nullptr;
+  }
+  buffer.reset();
+  memory.reset();
+  regions.clear();
+  size = head = tail = used = 0;
+}
+
+bool StagingRing::allocate(VkDeviceSize bytes, VkDeviceSize alignment,
+                           uint64_t retireValue, Allocation &allocation) {
+  if (mapped == nullptr || bytes > size) {
+    return false;
+  }
+  if (alignment == 0) {
+    alignment = 1;
+  }
+
+  VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+  VkDeviceSize consumed;
+  if (used == 0 || head > tail) {
+    // free space is [head, size) followed by [0, tail)
+    if (offset + bytes <= size) {
+      consumed = offset + bytes - head;
+    } else if (bytes <= tail || used == 0) {
+      // skip the end of the buffer and restart at 0
+      consumed = size - head + bytes;
+      offset = 0;
+      if (used == 0) {
+        head = tail = 0;
+        consumed = bytes;
+      }
+    } else {
+      return false;
+    }
+  } else {
+    // wrapped around: free space is [head, tail), empty when head == tail
+    if (offset + bytes > tail) {
+      return false;
+    }
+    consumed = offset + bytes - head;
+  }
+
+  used += consumed;
+  head = offset + bytes;
+  if (!regions.empty() && regions.back().retireValue == retireValue) {
+    regions.back().bytes += consumed;
+  } else {
+    regions.push_back({retireValue, consumed});
+  }
+
+  allocation.buffer = buffer;
+  allocation.offset = offset;
+  allocation.data = mapped + offset;
+  return true;
+}
+
+void StagingRing::collect(uint64_t completedValue) {
+  while (!regions.empty() && regions.front().retireValue <= completedValue) {
+    used -= regions.front().bytes;
+    tail = (tail + regions.front().bytes) % size;
+    regions.pop_front();
+  }
+  if (used == 0) {
+    head = tail = 0;
+  }
+}
@@ -0,0 +1,243 @@
+#include "trace.h"
+#include "logging.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace {
+
+const uint32_t RING_EVENTS = 16384;
+// track id of GPU events, far above any thread id
+const uint32_t GPU_TRACK = 1000000;
+
+struct Event {
+  const char *name;
+  uint64_t begin;
+  uint64_t end;
+  uint32_t track;
+};
+
+// Single producer, single consumer: the owning thread advances head, the
+// flushing thread advances tail. Rings of exited threads are handed to new
+// ones, so each event carries its own track id.
+struct Ring {
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  std::atomic<uint64_t> dropped;
+  bool owned;
+  Event events[RING_EVENTS];
+};
+
+std::atomic<bool> enabled(false);
+std::atomic<uint32_t> nextTrack(1);
+uint64_t startTime = 0;
+
+// guards everything below; only taken on a thread's first event, to name a
+// thread and to flush
+std::mutex mutex;
+std::vector<std::unique_ptr<Ring>> rings;
+std::vector<std::pair<uint32_t, std::string>> trackNames;
+size_t trackNamesWritten = 0;
+std::set<std::string> internedNames;
+std::FILE *file = nullptr;
+bool firstRecord = true;
+Ring *gpuRing = nullptr;
+
+Ring *acquireRing() {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &ring : rings) {
+    if (!ring->owned) {
+      ring->owned = true;
+      return ring.get();
+    }
+  }
+  rings.emplace_back(new Ring());
+  Ring *ring = rings.back().get();
+  ring->head = ring->tail = ring->dropped = 0;
+  ring->owned = true;
+  return ring;
+}
+
+struct ThreadTrack {
+  Ring *ring = nullptr;
+  uint32_t track = 0;
+
+  ~ThreadTrack() {
+    if (ring != nullptr) {
+      std::lock_guard<std::mutex> lock(mutex);
+      ring->owned = false;
+    }
+  }
+
+  void ensure() {
+    if (ring == nullptr) {
+      ring = acquireRing();
+      track = nextTrack++;
+    }
+  }
+};
+
+thread_local ThreadTrack threadTrack;
+
+void push(Ring *ring, const Event &event) {
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) >= RING_EVENTS) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ring->events[head % RING_EVENTS] = event;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void writeString(const char *s) {
+  std::fputc('"', file);
+  for (; *s != '\0'; ++s) {
+    if (*s == '"' || *s == '\\') {
+      std::fputc('\\', file);
+    }
+    if (static_cast<unsigned char>(*s) >= 0x20) {
+      std::fputc(*s, file);
+    }
+  }
+  std::fputc('"', file);
+}
+
+void beginRecord() {
+  std::fputs(firstRecord ? "\n" : ",\n", file);
+  firstRecord = false;
+}
+
+void writeTrackName(uint32_t track, const std::string &name) {
+  beginRecord();
+  std::fprintf(file,
+               "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%u,\"args\":{\"name\":",
+               track);
+  writeString(name.c_str());
+  std::fputs("}}", file);
+}
+
+// expects `mutex` to be held
+void flushLocked() {
+  if (file == nullptr) {
+    return;
+  }
+  for (; trackNamesWritten < trackNames.size(); ++trackNamesWritten) {
+    writeTrackName(trackNames[trackNamesWritten].first,
+                   trackNames[trackNamesWritten].second);
+  }
+  uint64_t dropped = 0;
+  for (auto &ring : rings) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail < head; ++tail) {
+      const Event &event = ring->events[tail % RING_EVENTS];
+      // timestamps in microseconds relative to traceStart()
+      double begin = (static_cast<double>(event.begin) -
+                      static_cast<double>(startTime)) /
+                     1000.0;
+      double duration =
+          event.end > event.begin ? (event.end - event.begin) / 1000.0 : 0.0;
+      beginRecord();
+      std::fputs("{\"name\":", file);
+      writeString(event.name);
+      std::fprintf(file,
+                   ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+                   "\"dur\":%.3f}",
+                   event.track, begin, duration);
+    }
+    ring->tail.store(head, std::memory_order_release);
+    dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+  }
+  std::fflush(file);
+  if (dropped != 0) {
+    LOG(WARNING) << "Trace: dropped " << dropped
+                 << " events, flush more often";
+  }
+}
+
+} // namespace
+
+void traceStart(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file != nullptr) {
+    return;
+  }
+  file = std::fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    LOG(ERROR) << "IO: Failed to open trace file " << path;
+    return;
+  }
+  // the closing bracket is optional in the array format, so the file stays
+  // readable if the process dies before traceStop()
+  std::fputc('[', file);
+  firstRecord = true;
+  trackNamesWritten = 0;
+  if (gpuRing == nullptr) {
+    rings.emplace_back(new Ring());
+    gpuRing = rings.back().get();
+    gpuRing->head = gpuRing->tail = gpuRing->dropped = 0;
+    gpuRing->owned = true;
+    trackNames.emplace_back(GPU_TRACK, "GPU");
+  }
+  startTime = traceNow();
+  enabled = true;
+}
+
+void traceFlush() {
+  std::lock_guard<std::mutex> lock(mutex);
+  flushLocked();
+}
+
+void traceStop() {
+  std::lock_guard<std::mutex> lock(mutex);
+  enabled = false;
+  if (file == nullptr) {
+    return;
+  }
+  flushLocked();
+  std::fputs("\n]\n", file);
+  std::fclose(file);
+  file = nullptr;
+}
+
+bool traceEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+uint64_t traceNow() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+void traceThreadName(const std::string &name) {
+  threadTrack.ensure();
+  std::lock_guard<std::mutex> lock(mutex);
+  trackNames.emplace_back(threadTrack.track, name);
+}
+
+const char *traceIntern(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return internedNames.insert(name).first->c_str();
+}
+
+void traceEvent(const char *name, uint64_t begin, uint64_t end) {
+  if (!traceEnabled()) {
+    return;
+  }
+  threadTrack.ensure();
+  push(threadTrack.ring, {name, begin, end, threadTrack.track});
+}
+
+void traceGpuEvent(const char *name, uint64_t begin, uint64_t end) {
+  // pairs with the store in traceStart() that publishes gpuRing
+  if (!enabled.load(std::memory_order_acquire)) {
+    return;
+  }
+  push(gpuRing, {name, begin, end, GPU_TRACK});
+}
@@ -0,0 +1,263 @@
+// Offline converter from Wavefront OBJ to the binary .mvm mesh format.
+//
+//   meshconv input.obj output.mvm
+//
+// A LOD chain is built by vertex clustering, triangles are reordered for the
+// post-transform vertex cache and split into meshlets, vertices are reordered
+// for fetch locality, and attributes are quantized to 16 bytes per vertex.
+
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+// stop simplifying below this many triangles
+const size_t MIN_LOD_TRIANGLES = 16;
+
+struct ObjData {
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t> indices;
+  bool hasNormals = false;
+};
+
+// OBJ indices are 1-based, negative ones count back from the end
+int resolveIndex(int index, size_t count) {
+  if (index > 0) {
+    return index - 1;
+  }
+  if (index < 0) {
+    return static_cast<int>(count) + index;
+  }
+  return -1;
+}
+
+ObjData loadObj(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    throw std::runtime_error("IO: Failed to open file!");
+  }
+
+  std::vector<float> positions, normals, uvs;
+  std::map<std::tuple<int, int, int>, uint32_t> uniqueVertices;
+  ObjData obj;
+
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream in(line);
+    std::string tag;
+    in >> tag;
+    if (tag == "v") {
+      float x = 0, y = 0, z = 0;
+      in >> x >> y >> z;
+      positions.insert(positions.end(), {x, y, z});
+    } else if (tag == "vn") {
+      float x = 0, y = 0, z = 0;
+      in >> x >> y >> z;
+      normals.insert(normals.end(), {x, y, z});
+    } else if (tag == "vt") {
+      float u = 0, v = 0;
+      in >> u >> v;
+      uvs.insert(uvs.end(), {u, v});
+    } else if (tag == "f") {
+      std::vector<uint32_t> face;
+      std::string corner;
+      while (in >> corner) {
+        int p = 0, t = 0, n = 0;
+        if (std::sscanf(corner.c_str(), "%d/%d/%d", &p, &t, &n) != 3 &&
+            std::sscanf(corner.c_str(), "%d//%d", &p, &n) != 2 &&
+            std::sscanf(corner.c_str(), "%d/%d", &p, &t) != 2) {
+          std::sscanf(corner.c_str(), "%d", &p);
+        }
+        std::tuple<int, int, int> key(resolveIndex(p, positions.size() / 3),
+                                      resolveIndex(t, uvs.size() / 2),
+                                      resolveIndex(n, normals.size() / 3));
+        auto it = uniqueVertices.find(key);
+        if (it == uniqueVertices.end()) {
+          MeshVertex vertex = {};
+          int pi = std::get<0>(key), ti = std::get<1>(key),
+              ni = std::get<2>(key);
+          if (pi < 0 || static_cast<size_t>(pi) * 3 >= positions.size()) {
+            throw std::runtime_error("OBJ: Invalid position index!");
+          }
+          for (int axis = 0; axis < 3; ++axis) {
+            vertex.position[axis] = positions[pi * 3 + axis];
+          }
+          if (ni >= 0 && static_cast<size_t>(ni) * 3 < normals.size()) {
+            for (int axis = 0; axis < 3; ++axis) {
+              vertex.normal[axis] = normals[ni * 3 + axis];
+            }
+            obj.hasNormals = true;
+          }
+          if (ti >= 0 && static_cast<size_t>(ti) * 2 < uvs.size()) {
+            vertex.uv[0] = uvs[ti * 2];
+            vertex.uv[1] = uvs[ti * 2 + 1];
+          }
+          it = uniqueVertices
+                   .insert(std::make_pair(
+                       key, static_cast<uint32_t>(obj.vertices.size())))
+                   .first;
+          obj.vertices.push_back(vertex);
+        }
+        face.push_back(it->second);
+      }
+      // triangulate polygons as a fan
+      for (size_t i = 2; i < face.size(); ++i) {
+        obj.indices.insert(obj.indices.end(), {face[0], face[i - 1], face[i]});
+      }
+    }
+  }
+  return obj;
+}
+
+void computeNormals(ObjData &obj) {
+  for (auto &vertex : obj.vertices) {
+    vertex.normal[0] = vertex.normal[1] = vertex.normal[2] = 0.0f;
+  }
+  for (size_t i = 0; i + 2 < obj.indices.size(); i += 3) {
+    MeshVertex &a = obj.vertices[obj.indices[i]];
+    MeshVertex &b = obj.vertices[obj.indices[i + 1]];
+    MeshVertex &c = obj.vertices[obj.indices[i + 2]];
+    float e1[3], e2[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      e1[axis] = b.position[axis] - a.position[axis];
+      e2[axis] = c.position[axis] - a.position[axis];
+    }
+    // area weighted face normal
+    float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                  e1[0] * e2[1] - e1[1] * e2[0]};
+    for (int axis = 0; axis < 3; ++axis) {
+      a.normal[axis] += n[axis];
+      b.normal[axis] += n[axis];
+      c.normal[axis] += n[axis];
+    }
+  }
+  for (auto &vertex : obj.vertices) {
+    float *n = vertex.normal;
+    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0.0f) {
+      n[0] /= length;
+      n[1] /= length;
+      n[2] /= length;
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::fprintf(stderr, "usage: %s input.obj output.mvm\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    ObjData obj = loadObj(argv[1]);
+    if (!obj.hasNormals) {
+      computeNormals(obj);
+    }
+    size_t vertexCount = obj.vertices.size();
+    std::vector<float> positions(vertexCount * 3);
+    for (size_t v = 0; v < vertexCount; ++v) {
+      std::copy(obj.vertices[v].position, obj.vertices[v].position + 3,
+                &positions[v * 3]);
+    }
+
+    // every level is simplified from LOD 0 with half the grid resolution of
+    // the previous attempt, starting around one vertex per cell; levels that
+    // barely reduce the triangle count are skipped
+    std::vector<std::vector<uint32_t>> lodIndices(1, obj.indices);
+    std::vector<float> lodErrors(1, 0.0f);
+    uint32_t gridSize =
+        static_cast<uint32_t>(std::sqrt(static_cast<double>(vertexCount)));
+    while (lodIndices.size() < MESH_MAX_LODS && gridSize >= 2) {
+      float error = 0.0f;
+      std::vector<uint32_t> lod =
+          simplifyClustered(obj.indices, positions, gridSize, error);
+      gridSize /= 2;
+      if (lod.size() / 3 < MIN_LOD_TRIANGLES) {
+        break;
+      }
+      if (lod.size() <= lodIndices.back().size() * 3 / 4) {
+        lodIndices.push_back(lod);
+        lodErrors.push_back(error);
+      }
+    }
+
+    float acmrBefore = computeAcmr(lodIndices[0], vertexCount);
+    for (auto &lod : lodIndices) {
+      optimizeVertexCache(lod, vertexCount);
+    }
+    float acmrAfter = computeAcmr(lodIndices[0], vertexCount);
+
+    // one fetch order for all levels, LOD 0 first
+    std::vector<uint32_t> indices;
+    for (const auto &lod : lodIndices) {
+      indices.insert(indices.end(), lod.begin(), lod.end());
+    }
+    std::vector<uint32_t> remap = optimizeVertexFetch(indices, vertexCount);
+    obj.vertices = remapVertices(obj.vertices, remap);
+
+    MeshHeader header = {};
+    std::vector<PackedVertex> packed = quantizeVertices(obj.vertices, header);
+
+    // meshlet bounds use the positions the GPU will see
+    positions.resize(packed.size() * 3);
+    for (size_t v = 0; v < packed.size(); ++v) {
+      for (int axis = 0; axis < 3; ++axis) {
+        float extent = header.boundsMax[axis] - header.boundsMin[axis];
+        positions[v * 3 + axis] =
+            header.boundsMin[axis] +
+            packed[v].position[axis] / 65535.0f * extent;
+      }
+    }
+
+    std::vector<MeshLod> lods;
+    std::vector<Meshlet> meshlets;
+    size_t lodStart = 0;
+    for (size_t i = 0; i < lodIndices.size(); ++i) {
+      size_t lodSize = lodIndices[i].size();
+      std::vector<uint32_t> lod(indices.begin() + lodStart,
+                                indices.begin() + lodStart + lodSize);
+      std::vector<Meshlet> lodMeshlets = buildMeshlets(lod, positions);
+      for (auto &meshlet : lodMeshlets) {
+        meshlet.firstIndex += static_cast<uint32_t>(lodStart);
+      }
+      MeshLod meshLod = {};
+      meshLod.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+      meshLod.meshletCount = static_cast<uint32_t>(lodMeshlets.size());
+      meshLod.indexCount = static_cast<uint32_t>(lodSize);
+      meshLod.error = lodErrors[i];
+      lods.push_back(meshLod);
+      meshlets.insert(meshlets.end(), lodMeshlets.begin(), lodMeshlets.end());
+      lodStart += lodSize;
+    }
+
+    writeMesh(argv[2], packed, indices, lods, meshlets, header);
+
+    std::printf("%zu vertices, %zu triangles, ACMR %.3f -> %.3f\n",
+                obj.vertices.size(), lodIndices[0].size() / 3, acmrBefore,
+                acmrAfter);
+    for (size_t i = 0; i < lods.size(); ++i) {
+      std::printf("LOD %zu: %u triangles, %u meshlets, error %g\n", i,
+                  lods[i].indexCount / 3, lods[i].meshletCount,
+                  lods[i].error);
+    }
+  } catch (const std::runtime_error &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}